@@ -0,0 +1,141 @@
+/*
+ * タイルの bitmap で damage を覚えておく。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "damage.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define NR_WORDS(d) (((d)->tiles_x * (d)->tiles_y + 63) / 64)
+
+void damage_init(struct damage *d, int width, int height, int tile_size)
+{
+    d->width = width;
+    d->height = height;
+    d->tile_size = tile_size;
+    d->tiles_x = (width + tile_size - 1) / tile_size;
+    d->tiles_y = (height + tile_size - 1) / tile_size;
+    if ((d->bits = calloc(NR_WORDS(d) + 1, sizeof *d->bits)) == NULL) {
+	fprintf(stderr, "out of memory.\n");
+	exit(1);
+    }
+}
+
+void damage_fini(struct damage *d)
+{
+    free(d->bits);
+    d->bits = NULL;
+}
+
+void damage_clear(struct damage *d)
+{
+    memset(d->bits, 0, NR_WORDS(d) * sizeof *d->bits);
+}
+
+void damage_all(struct damage *d)
+{
+    int n = d->tiles_x * d->tiles_y;
+    memset(d->bits, 0xff, n / 64 * sizeof *d->bits);
+    if (n % 64)
+	d->bits[n / 64] = (UINT64_C(1) << (n % 64)) - 1;
+}
+
+void damage_add(struct damage *d, int x, int y, int w, int h)
+{
+    int x0 = MAX(x, 0), y0 = MAX(y, 0);
+    int x1 = MIN(x + w, d->width), y1 = MIN(y + h, d->height);
+    if (x0 >= x1 || y0 >= y1)
+	return;
+    
+    for (int ty = y0 / d->tile_size; ty <= (y1 - 1) / d->tile_size; ty++) {
+	for (int tx = x0 / d->tile_size; tx <= (x1 - 1) / d->tile_size; tx++) {
+	    int t = ty * d->tiles_x + tx;
+	    d->bits[t / 64] |= UINT64_C(1) << (t % 64);
+	}
+    }
+}
+
+void damage_or(struct damage *d, const struct damage *s)
+{
+    for (int i = 0; i < NR_WORDS(d); i++)
+	d->bits[i] |= s->bits[i];
+}
+
+int damage_test(const struct damage *d, int tile)
+{
+    return d->bits[tile / 64] >> (tile % 64) & 1;
+}
+
+/* 立っているタイルの番号を tiles に並べて、個数を返す。 */
+int damage_tiles(const struct damage *d, int *tiles)
+{
+    int n = 0;
+    for (int i = 0; i < NR_WORDS(d); i++) {
+	for (uint64_t w = d->bits[i]; w; w &= w - 1)
+	    tiles[n++] = i * 64 + __builtin_ctzll(w);
+    }
+    return n;
+}
+
+void damage_tile_rect(const struct damage *d, int tile, struct rect *r)
+{
+    r->x0 = tile % d->tiles_x * d->tile_size;
+    r->y0 = tile / d->tiles_x * d->tile_size;
+    r->x1 = MIN(r->x0 + d->tile_size, d->width);
+    r->y1 = MIN(r->y0 + d->tile_size, d->height);
+}
+
+/*
+ * タイル行ごとの連続区間を矩形にし、すぐ上の行に同じ横幅の矩形があれば
+ * 縦につなぐ。max 個に収まらなければ全体を囲む 1 個にする。
+ */
+int damage_rects(const struct damage *d, struct rect *rects, int max)
+{
+    int n = 0, overflow = 0;
+    struct rect bbox = { d->width, d->height, 0, 0 };
+    
+    for (int ty = 0; ty < d->tiles_y; ty++) {
+	for (int tx = 0; tx < d->tiles_x; tx++) {
+	    if (!damage_test(d, ty * d->tiles_x + tx))
+		continue;
+	    int tx1 = tx;
+	    while (tx1 + 1 < d->tiles_x && damage_test(d, ty * d->tiles_x + tx1 + 1))
+		tx1++;
+	    
+	    struct rect r;
+	    r.x0 = tx * d->tile_size;
+	    r.x1 = MIN((tx1 + 1) * d->tile_size, d->width);
+	    r.y0 = ty * d->tile_size;
+	    r.y1 = MIN((ty + 1) * d->tile_size, d->height);
+	    tx = tx1;
+	    
+	    bbox.x0 = MIN(bbox.x0, r.x0);
+	    bbox.y0 = MIN(bbox.y0, r.y0);
+	    bbox.x1 = MAX(bbox.x1, r.x1);
+	    bbox.y1 = MAX(bbox.y1, r.y1);
+	    
+	    int i;
+	    for (i = 0; i < n; i++) {
+		if (rects[i].x0 == r.x0 && rects[i].x1 == r.x1 && rects[i].y1 == r.y0) {
+		    rects[i].y1 = r.y1;
+		    break;
+		}
+	    }
+	    if (i < n)
+		continue;
+	    if (n < max)
+		rects[n++] = r;
+	    else
+		overflow = 1;
+	}
+    }
+    
+    if (overflow) {
+	rects[0] = bbox;
+	n = 1;
+    }
+    return n;
+}
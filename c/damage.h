@@ -0,0 +1,29 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdint.h>
+
+struct rect {
+    int x0, y0, x1, y1;
+};
+
+/* タイル単位の damage。1 タイル 1 bit。 */
+struct damage {
+    int width, height;
+    int tile_size;
+    int tiles_x, tiles_y;
+    uint64_t *bits;
+};
+
+void damage_init(struct damage *d, int width, int height, int tile_size);
+void damage_fini(struct damage *d);
+void damage_clear(struct damage *d);
+void damage_all(struct damage *d);
+void damage_add(struct damage *d, int x, int y, int w, int h);
+void damage_or(struct damage *d, const struct damage *s);
+int damage_test(const struct damage *d, int tile);
+int damage_tiles(const struct damage *d, int *tiles);
+void damage_tile_rect(const struct damage *d, int tile, struct rect *r);
+int damage_rects(const struct damage *d, struct rect *rects, int max);
+
+#endif
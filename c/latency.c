@@ -0,0 +1,121 @@
+/*
+ * wp_presentation の feedback から paint/commit から画面に出るまでの
+ * 時間を集計する。
+ */
+#include <stdio.h>
+#include <string.h>
+#include "latency.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+void latency_init(struct latency *l, FILE *csv)
+{
+    memset(l, 0, sizeof *l);
+    l->csv = csv;
+    if (csv)
+	fprintf(csv, "seq,paint_ns,commit_ns,present_ns,refresh_ns,msc,flags,paint_to_present_us,commit_to_present_us\n");
+}
+
+static void histogram_add(struct latency_histogram *h, uint64_t ns)
+{
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max)
+	h->max = ns;
+    h->buckets[MIN(ns / LATENCY_BUCKET_NS, LATENCY_BUCKETS - 1)]++;
+}
+
+void latency_presented(struct latency *l, const struct frame_times *f)
+{
+    uint64_t paint = f->present > f->paint ? f->present - f->paint : 0;
+    uint64_t commit = f->present > f->commit ? f->present - f->commit : 0;
+    
+    histogram_add(&l->paint_to_present, paint);
+    histogram_add(&l->commit_to_present, commit);
+    
+    /*
+     * 毎フレーム commit しているなら、前のフレームの次の vblank に出るはず。
+     * target のあるフレームは target の後の最初の frame callback で commit
+     * するので、その次の vblank に出るはず。わざと待たせた分は数えず、
+     * それより遅れた分だけ逃したことにする。msc が無い compositor では
+     * refresh から数える。
+     */
+    if (l->presented) {
+	uint64_t vblanks = 0, expected = 1;
+	if (f->msc > l->last_msc)
+	    vblanks = f->msc - l->last_msc;
+	else if (f->msc == 0 && f->refresh)
+	    vblanks = (f->present - l->last_present + f->refresh / 2) / f->refresh;
+	if (f->target > l->last_present) {
+	    if (f->refresh)
+		expected += (f->target - l->last_present + f->refresh - 1) / f->refresh;
+	    else
+		expected = vblanks;	/* いつ出るはずか分からない */
+	}
+	if (vblanks > expected)
+	    l->missed += vblanks - expected;
+    }
+    l->presented++;
+    l->last_msc = f->msc;
+    l->last_present = f->present;
+    
+    if (l->csv)
+	fprintf(l->csv, "%u,%llu,%llu,%llu,%u,%llu,0x%x,%.1f,%.1f\n", f->seq,
+		(unsigned long long) f->paint, (unsigned long long) f->commit,
+		(unsigned long long) f->present, f->refresh,
+		(unsigned long long) f->msc, f->flags, paint / 1e3, commit / 1e3);
+}
+
+void latency_discarded(struct latency *l, const struct frame_times *f)
+{
+    l->discarded++;
+    if (l->csv)
+	fprintf(l->csv, "%u,%llu,%llu,,,,,,\n", f->seq,
+		(unsigned long long) f->paint, (unsigned long long) f->commit);
+}
+
+/* p (0..1) の位置のバケツの上端。あふれたときは最大値。 */
+uint64_t latency_percentile(const struct latency_histogram *h, double p)
+{
+    uint64_t rank = (uint64_t) (p * h->count + 0.5), n = 0;
+    if (rank == 0)
+	rank = 1;
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++) {
+	if ((n += h->buckets[i]) >= rank)
+	    return MIN((uint64_t) (i + 1) * LATENCY_BUCKET_NS, h->max);
+    }
+    return h->max;
+}
+
+static void histogram_report(FILE *fp, const char *name, const struct latency_histogram *h, int histogram)
+{
+    if (h->count == 0)
+	return;
+    fprintf(fp, "%s: p50 %.2f ms, p99 %.2f ms, mean %.2f ms, max %.2f ms.\n", name,
+	    latency_percentile(h, 0.50) / 1e6, latency_percentile(h, 0.99) / 1e6,
+	    (double) h->sum / h->count / 1e6, h->max / 1e6);
+    if (!histogram)
+	return;
+    
+    uint32_t peak = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+	if (h->buckets[i] > peak)
+	    peak = h->buckets[i];
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+	if (h->buckets[i] == 0)
+	    continue;
+	int bar = (int) ((uint64_t) h->buckets[i] * 50 / peak);
+	fprintf(fp, "  %6.2f ms%s %8u %.*s\n", (double) i * LATENCY_BUCKET_NS / 1e6,
+		i == LATENCY_BUCKETS - 1 ? "+" : " ", h->buckets[i], bar ? bar : 1,
+		"**************************************************");
+    }
+}
+
+void latency_report(FILE *fp, const struct latency *l, int histogram)
+{
+    fprintf(fp, "presented %llu, discarded %llu, missed vblanks %llu.\n",
+	    (unsigned long long) l->presented, (unsigned long long) l->discarded,
+	    (unsigned long long) l->missed);
+    histogram_report(fp, "paint to present", &l->paint_to_present, histogram);
+    histogram_report(fp, "commit to present", &l->commit_to_present, histogram);
+}
@@ -0,0 +1,39 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LATENCY_BUCKETS 256
+#define LATENCY_BUCKET_NS 250000	/* 0.25 ms 刻み。最後のバケツは 64 ms 以上 */
+
+struct latency_histogram {
+    uint64_t count;
+    uint64_t sum, max;		/* ns */
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+/* 1 フレーム分の時刻 (ns)。clock は wp_presentation の clock_id。 */
+struct frame_times {
+    uint32_t seq;
+    uint64_t paint, commit, present;
+    uint64_t target;		/* -v でこのフレームの番が来た時刻。0 なら毎フレーム出す */
+    uint32_t refresh;
+    uint64_t msc;
+    uint32_t flags;
+};
+
+struct latency {
+    FILE *csv;
+    struct latency_histogram paint_to_present, commit_to_present;
+    uint64_t presented, discarded, missed;
+    uint64_t last_msc, last_present;
+};
+
+void latency_init(struct latency *l, FILE *csv);
+void latency_presented(struct latency *l, const struct frame_times *f);
+void latency_discarded(struct latency *l, const struct frame_times *f);
+uint64_t latency_percentile(const struct latency_histogram *h, double p);
+void latency_report(FILE *fp, const struct latency *l, int histogram);
+
+#endif
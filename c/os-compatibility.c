@@ -0,0 +1,121 @@
+/*
+ * shm バッファ用の無名ファイル。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "os-compatibility.h"
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+static int create_tmpfile_cloexec(void)
+{
+    static const char template[] = "/wltest-shared-XXXXXX";
+    const char *path = getenv("XDG_RUNTIME_DIR");
+    char *name;
+    int fd;
+    
+    if (!path) {
+	errno = ENOENT;
+	return -1;
+    }
+    if ((name = malloc(strlen(path) + sizeof template)) == NULL)
+	return -1;
+    strcpy(name, path);
+    strcat(name, template);
+    
+    fd = mkostemp(name, O_CLOEXEC);
+    if (fd >= 0)
+	unlink(name);
+    free(name);
+    return fd;
+}
+
+/* 書き込みで 0 埋めはしない。tmpfs の領域だけ先に確保する。 */
+int os_resize_anonymous_file(int fd, off_t size)
+{
+    int ret = posix_fallocate(fd, 0, size);
+    if (ret == EINVAL || ret == EOPNOTSUPP)
+	ret = ftruncate(fd, size) < 0 ? errno : 0;
+    if (ret != 0) {
+	errno = ret;
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * 使わなくなった範囲のページを捨てる。大きさは変えないので封印とは
+ * ぶつからない。できなくても困らないので失敗は呼ぶ側で無視してよい。
+ */
+int os_release_anonymous_file(int fd, off_t offset, off_t len)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+int os_create_anonymous_file(off_t size)
+{
+    int fd;
+    
+#ifdef MFD_CLOEXEC
+    fd = memfd_create("wltest-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+#endif
+	fd = create_tmpfile_cloexec();
+    if (fd < 0)
+	return -1;
+    
+    if (os_resize_anonymous_file(fd, size) < 0) {
+	int err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+    }
+    
+#ifdef F_ADD_SEALS
+    /*
+     * compositor が見ている間に縮められると SIGBUS になるので封じる。
+     * 伸ばすのは shm pool が使うので封じない。
+     */
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+#endif
+    
+    return fd;
+}
+
+static void advise_hugepage(void *data, size_t size, int hugepage)
+{
+#ifdef MADV_HUGEPAGE
+    /* shmem_enabled=advise なら大きいバッファは THP に載る。 */
+    if (hugepage && size >= HUGEPAGE_SIZE) {
+	if (madvise(data, size, MADV_HUGEPAGE) < 0)
+	    fprintf(stderr, "madvise(MADV_HUGEPAGE) failed: %m\n");
+    }
+#endif
+}
+
+void *os_map_anonymous_file(int fd, size_t size, int hugepage)
+{
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED)
+	advise_hugepage(data, size, hugepage);
+    return data;
+}
+
+void *os_remap_anonymous_file(void *data, size_t old_size, size_t new_size, int hugepage)
+{
+    data = mremap(data, old_size, new_size, MREMAP_MAYMOVE);
+    if (data != MAP_FAILED)
+	advise_hugepage(data, new_size, hugepage);
+    return data;
+}
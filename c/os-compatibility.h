@@ -0,0 +1,12 @@
+#ifndef OS_COMPATIBILITY_H
+#define OS_COMPATIBILITY_H
+
+#include <sys/types.h>
+
+int os_create_anonymous_file(off_t size);
+int os_resize_anonymous_file(int fd, off_t size);
+int os_release_anonymous_file(int fd, off_t offset, off_t len);
+void *os_map_anonymous_file(int fd, size_t size, int hugepage);
+void *os_remap_anonymous_file(void *data, size_t old_size, size_t new_size, int hugepage);
+
+#endif
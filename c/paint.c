@@ -0,0 +1,897 @@
+/*
+ * ピクセルを塗るカーネル。起動時に cpuid を見て実装を選ぶ。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "paint.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define DIV255(t) (((t) + 128 + (((t) + 128) >> 8)) >> 8)
+
+/*
+ * c0 から c1 へ count ピクセルかけて変化させる。各チャネル 16.16 固定小数点で、
+ * i 番目の値は (base + step * i) >> 16。SIMD 版も同じ式で計算するので結果は一致する。
+ */
+static void ramp_setup(uint32_t c0, uint32_t c1, int count, int32_t base[4], int32_t step[4])
+{
+    for (int ch = 0; ch < 4; ch++) {
+	int a = c0 >> (ch * 8) & 0xff;
+	int b = c1 >> (ch * 8) & 0xff;
+	base[ch] = (a << 16) + 0x8000;
+	step[ch] = count > 1 ? (b - a) * 65536 / (count - 1) : 0;
+    }
+}
+
+static void gradient_tail(uint32_t *dst, const int32_t base[4], const int32_t step[4], int i, int count)
+{
+    for (; i < count; i++) {
+	uint32_t p = 0;
+	for (int ch = 0; ch < 4; ch++)
+	    p |= (uint32_t) ((base[ch] + step[ch] * i) >> 16) << (ch * 8);
+	dst[i] = p;
+    }
+}
+
+static void alpha_ramp_tail(uint32_t *dst, int32_t base, int32_t step, int i, int count)
+{
+    for (; i < count; i++) {
+	uint32_t a = (base + step * i) >> 16;
+	uint32_t p = dst[i], r = 0;
+	for (int ch = 0; ch < 4; ch++) {
+	    uint32_t c = (p >> (ch * 8) & 0xff) * a;
+	    r |= DIV255(c) << (ch * 8);
+	}
+	dst[i] = r;
+    }
+}
+
+static void blend_tail(uint32_t *dst, const uint32_t *src, int i, int count)
+{
+    for (; i < count; i++) {
+	uint32_t s = src[i], d = dst[i], r = 0;
+	uint32_t ia = 255 - (s >> 24);
+	for (int ch = 0; ch < 4; ch++) {
+	    uint32_t t = (d >> (ch * 8) & 0xff) * ia;
+	    uint32_t c = (s >> (ch * 8) & 0xff) + DIV255(t);
+	    r |= (c > 255 ? 255 : c) << (ch * 8);
+	}
+	dst[i] = r;
+    }
+}
+
+static void yuv420_tail(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v, int i, int count)
+{
+    for (; i < count; i++)
+	dst[i] = yuv_pixel(y[i], u[i / 2], v[i / 2]);
+}
+
+/* scalar */
+
+static void fill_c(uint32_t *dst, uint32_t color, int count)
+{
+    for (int i = 0; i < count; i++)
+	dst[i] = color;
+}
+
+static void gradient_c(uint32_t *dst, uint32_t c0, uint32_t c1, int count)
+{
+    int32_t base[4], step[4];
+    ramp_setup(c0, c1, count, base, step);
+    gradient_tail(dst, base, step, 0, count);
+}
+
+static void alpha_ramp_c(uint32_t *dst, int a0, int a1, int count)
+{
+    int32_t base[4], step[4];
+    ramp_setup(a0, a1, count, base, step);
+    alpha_ramp_tail(dst, base[0], step[0], 0, count);
+}
+
+static void blend_c(uint32_t *dst, const uint32_t *src, int count)
+{
+    blend_tail(dst, src, 0, count);
+}
+
+static void copy_c(uint32_t *dst, const uint32_t *src, int count)
+{
+    memmove(dst, src, count * sizeof *dst);
+}
+
+static void fill16_c(uint16_t *dst, uint16_t color, int count)
+{
+    for (int i = 0; i < count; i++)
+	dst[i] = color;
+}
+
+static void copy16_c(uint16_t *dst, const uint16_t *src, int count)
+{
+    memmove(dst, src, count * sizeof *dst);
+}
+
+static void to_rgb565_c(uint16_t *dst, const uint32_t *src, int count)
+{
+    for (int i = 0; i < count; i++)
+	dst[i] = rgb565(src[i]);
+}
+
+static void yuv420_c(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v, int count)
+{
+    yuv420_tail(dst, y, u, v, 0, count);
+}
+
+static const struct paint_kernels kernels_c = {
+    "scalar", fill_c, gradient_c, alpha_ramp_c, blend_c, copy_c,
+    fill16_c, copy16_c, to_rgb565_c, yuv420_c,
+};
+
+#ifdef HAVE_X86
+
+/* SSE2 */
+
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *dst, uint32_t color, int count)
+{
+    __m128i c = _mm_set1_epi32(color);
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+	_mm_storeu_si128((__m128i *) (dst + i), c);
+    for (; i < count; i++)
+	dst[i] = color;
+}
+
+__attribute__((target("sse2")))
+static void gradient_sse2(uint32_t *dst, uint32_t c0, uint32_t c1, int count)
+{
+    int32_t base[4], step[4];
+    __m128i acc[4], inc[4];
+    int i = 0;
+    
+    ramp_setup(c0, c1, count, base, step);
+    for (int ch = 0; ch < 4; ch++) {
+	acc[ch] = _mm_setr_epi32(base[ch], base[ch] + step[ch],
+		base[ch] + step[ch] * 2, base[ch] + step[ch] * 3);
+	inc[ch] = _mm_set1_epi32(step[ch] * 4);
+    }
+    for (; i + 4 <= count; i += 4) {
+	__m128i p = _mm_srli_epi32(acc[0], 16);
+	p = _mm_or_si128(p, _mm_slli_epi32(_mm_srli_epi32(acc[1], 16), 8));
+	p = _mm_or_si128(p, _mm_slli_epi32(_mm_srli_epi32(acc[2], 16), 16));
+	p = _mm_or_si128(p, _mm_slli_epi32(_mm_srli_epi32(acc[3], 16), 24));
+	_mm_storeu_si128((__m128i *) (dst + i), p);
+	for (int ch = 0; ch < 4; ch++)
+	    acc[ch] = _mm_add_epi32(acc[ch], inc[ch]);
+    }
+    gradient_tail(dst, base, step, i, count);
+}
+
+/* 各ピクセルの 8bit 値 (32bit lane) を、unpack した 16bit x 4ch に広げる。 */
+__attribute__((target("sse2")))
+static inline void spread_sse2(__m128i a, __m128i *lo, __m128i *hi)
+{
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    *lo = _mm_unpacklo_epi32(a, a);
+    *hi = _mm_unpackhi_epi32(a, a);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i div255_sse2(__m128i t)
+{
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void alpha_ramp_sse2(uint32_t *dst, int a0, int a1, int count)
+{
+    int32_t base[4], step[4];
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    
+    ramp_setup(a0, a1, count, base, step);
+    __m128i acc = _mm_setr_epi32(base[0], base[0] + step[0], base[0] + step[0] * 2, base[0] + step[0] * 3);
+    __m128i inc = _mm_set1_epi32(step[0] * 4);
+    for (; i + 4 <= count; i += 4) {
+	__m128i d = _mm_loadu_si128((__m128i *) (dst + i));
+	__m128i alo, ahi;
+	spread_sse2(_mm_srli_epi32(acc, 16), &alo, &ahi);
+	__m128i lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), alo));
+	__m128i hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ahi));
+	_mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(lo, hi));
+	acc = _mm_add_epi32(acc, inc);
+    }
+    alpha_ramp_tail(dst, base[0], step[0], i, count);
+}
+
+__attribute__((target("sse2")))
+static void blend_sse2(uint32_t *dst, const uint32_t *src, int count)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i ff = _mm_set1_epi32(255);
+    int i = 0;
+    
+    for (; i + 4 <= count; i += 4) {
+	__m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+	__m128i d = _mm_loadu_si128((__m128i *) (dst + i));
+	__m128i alo, ahi;
+	spread_sse2(_mm_sub_epi32(ff, _mm_srli_epi32(s, 24)), &alo, &ahi);
+	__m128i lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), alo));
+	__m128i hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ahi));
+	_mm_storeu_si128((__m128i *) (dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+    blend_tail(dst, src, i, count);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(uint32_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+    if (dst > src && dst < src + count) {
+	memmove(dst, src, count * sizeof *dst);
+	return;
+    }
+    for (; i + 4 <= count; i += 4)
+	_mm_storeu_si128((__m128i *) (dst + i), _mm_loadu_si128((const __m128i *) (src + i)));
+    for (; i < count; i++)
+	dst[i] = src[i];
+}
+
+__attribute__((target("sse2")))
+static void fill16_sse2(uint16_t *dst, uint16_t color, int count)
+{
+    __m128i c = _mm_set1_epi16(color);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+	_mm_storeu_si128((__m128i *) (dst + i), c);
+    for (; i < count; i++)
+	dst[i] = color;
+}
+
+__attribute__((target("sse2")))
+static void copy16_sse2(uint16_t *dst, const uint16_t *src, int count)
+{
+    int i = 0;
+    if (dst > src && dst < src + count) {
+	memmove(dst, src, count * sizeof *dst);
+	return;
+    }
+    for (; i + 8 <= count; i += 8)
+	_mm_storeu_si128((__m128i *) (dst + i), _mm_loadu_si128((const __m128i *) (src + i)));
+    for (; i < count; i++)
+	dst[i] = src[i];
+}
+
+__attribute__((target("sse2")))
+static inline __m128i rgb565_sse2(__m128i p)
+{
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+    /* packs は符号付きで飽和するので、いったん 0x8000 ずらす。 */
+    return _mm_sub_epi32(_mm_or_si128(_mm_or_si128(r, g), b), _mm_set1_epi32(0x8000));
+}
+
+__attribute__((target("sse2")))
+static void to_rgb565_sse2(uint16_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+	__m128i lo = rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + i)));
+	__m128i hi = rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + i + 4)));
+	__m128i p = _mm_add_epi16(_mm_packs_epi32(lo, hi), _mm_set1_epi16(-0x8000));
+	_mm_storeu_si128((__m128i *) (dst + i), p);
+    }
+    for (; i < count; i++)
+	dst[i] = rgb565(src[i]);
+}
+
+/*
+ * yuv_pixel() の式を madd で 32bit に広げて計算する。y, d (u - 128), e (v - 128)
+ * は 16bit で、d と e は 2 ピクセルずつ同じ値。結果は packs/packus で 0..255 に
+ * 飽和させるので scalar と一致する。x86 の 128bit lane 単位の処理なので、
+ * AVX2/AVX-512 でも lane ごとに同じことをする。
+ */
+#define YUV_COEF(a, b) ((int32_t) ((uint32_t) (uint16_t) (b) << 16 | (uint16_t) (a)))
+
+__attribute__((target("sse2")))
+static inline __m128i yuv_channel_sse2(__m128i cy, __m128i de, __m128i coef)
+{
+    return _mm_srai_epi32(_mm_add_epi32(cy, _mm_madd_epi16(de, coef)), 8);
+}
+
+/* 8 ピクセル。y16, d16, e16 は 16bit x 8 */
+__attribute__((target("sse2")))
+static inline void yuv8_sse2(uint32_t *dst, __m128i y16, __m128i d16, __m128i e16)
+{
+    __m128i one = _mm_set1_epi16(1);
+    __m128i cylo = _mm_madd_epi16(_mm_unpacklo_epi16(y16, one), _mm_set1_epi32(YUV_COEF(298, 128 - 16 * 298)));
+    __m128i cyhi = _mm_madd_epi16(_mm_unpackhi_epi16(y16, one), _mm_set1_epi32(YUV_COEF(298, 128 - 16 * 298)));
+    __m128i delo = _mm_unpacklo_epi16(d16, e16), dehi = _mm_unpackhi_epi16(d16, e16);
+    __m128i kr = _mm_set1_epi32(YUV_COEF(0, 409));
+    __m128i kg = _mm_set1_epi32(YUV_COEF(-100, -208));
+    __m128i kb = _mm_set1_epi32(YUV_COEF(516, 0));
+    __m128i r = _mm_packs_epi32(yuv_channel_sse2(cylo, delo, kr), yuv_channel_sse2(cyhi, dehi, kr));
+    __m128i g = _mm_packs_epi32(yuv_channel_sse2(cylo, delo, kg), yuv_channel_sse2(cyhi, dehi, kg));
+    __m128i b = _mm_packs_epi32(yuv_channel_sse2(cylo, delo, kb), yuv_channel_sse2(cyhi, dehi, kb));
+    __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+    __m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_set1_epi8(-1));
+    _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+__attribute__((target("sse2")))
+static void yuv420_sse2(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v, int count)
+{
+    __m128i zero = _mm_setzero_si128(), c128 = _mm_set1_epi16(128);
+    int i = 0;
+    
+    for (; i + 8 <= count; i += 8) {
+	int32_t u4, v4;
+	memcpy(&u4, u + i / 2, 4);
+	memcpy(&v4, v + i / 2, 4);
+	__m128i y16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (y + i)), zero);
+	__m128i d16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u4), zero);
+	__m128i e16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero);
+	d16 = _mm_sub_epi16(_mm_unpacklo_epi16(d16, d16), c128);
+	e16 = _mm_sub_epi16(_mm_unpacklo_epi16(e16, e16), c128);
+	yuv8_sse2(dst + i, y16, d16, e16);
+    }
+    yuv420_tail(dst, y, u, v, i, count);
+}
+
+static const struct paint_kernels kernels_sse2 = {
+    "sse2", fill_sse2, gradient_sse2, alpha_ramp_sse2, blend_sse2, copy_sse2,
+    fill16_sse2, copy16_sse2, to_rgb565_sse2, yuv420_sse2,
+};
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *dst, uint32_t color, int count)
+{
+    __m256i c = _mm256_set1_epi32(color);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+	_mm256_storeu_si256((__m256i *) (dst + i), c);
+    for (; i < count; i++)
+	dst[i] = color;
+}
+
+__attribute__((target("avx2")))
+static void gradient_avx2(uint32_t *dst, uint32_t c0, uint32_t c1, int count)
+{
+    int32_t base[4], step[4];
+    __m256i acc[4], inc[4];
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    int i = 0;
+    
+    ramp_setup(c0, c1, count, base, step);
+    for (int ch = 0; ch < 4; ch++) {
+	acc[ch] = _mm256_add_epi32(_mm256_set1_epi32(base[ch]),
+		_mm256_mullo_epi32(lane, _mm256_set1_epi32(step[ch])));
+	inc[ch] = _mm256_set1_epi32(step[ch] * 8);
+    }
+    for (; i + 8 <= count; i += 8) {
+	__m256i p = _mm256_srli_epi32(acc[0], 16);
+	p = _mm256_or_si256(p, _mm256_slli_epi32(_mm256_srli_epi32(acc[1], 16), 8));
+	p = _mm256_or_si256(p, _mm256_slli_epi32(_mm256_srli_epi32(acc[2], 16), 16));
+	p = _mm256_or_si256(p, _mm256_slli_epi32(_mm256_srli_epi32(acc[3], 16), 24));
+	_mm256_storeu_si256((__m256i *) (dst + i), p);
+	for (int ch = 0; ch < 4; ch++)
+	    acc[ch] = _mm256_add_epi32(acc[ch], inc[ch]);
+    }
+    gradient_tail(dst, base, step, i, count);
+}
+
+/* unpack/pack は 128bit lane ごとなので、広げ方も lane ごとで辻褄が合う。 */
+__attribute__((target("avx2")))
+static inline void spread_avx2(__m256i a, __m256i *lo, __m256i *hi)
+{
+    a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+    *lo = _mm256_unpacklo_epi32(a, a);
+    *hi = _mm256_unpackhi_epi32(a, a);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div255_avx2(__m256i t)
+{
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void alpha_ramp_avx2(uint32_t *dst, int a0, int a1, int count)
+{
+    int32_t base[4], step[4];
+    __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    
+    ramp_setup(a0, a1, count, base, step);
+    __m256i acc = _mm256_add_epi32(_mm256_set1_epi32(base[0]),
+	    _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(step[0])));
+    __m256i inc = _mm256_set1_epi32(step[0] * 8);
+    for (; i + 8 <= count; i += 8) {
+	__m256i d = _mm256_loadu_si256((__m256i *) (dst + i));
+	__m256i alo, ahi;
+	spread_avx2(_mm256_srli_epi32(acc, 16), &alo, &ahi);
+	__m256i lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), alo));
+	__m256i hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ahi));
+	_mm256_storeu_si256((__m256i *) (dst + i), _mm256_packus_epi16(lo, hi));
+	acc = _mm256_add_epi32(acc, inc);
+    }
+    alpha_ramp_tail(dst, base[0], step[0], i, count);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t *dst, const uint32_t *src, int count)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i ff = _mm256_set1_epi32(255);
+    int i = 0;
+    
+    for (; i + 8 <= count; i += 8) {
+	__m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+	__m256i d = _mm256_loadu_si256((__m256i *) (dst + i));
+	__m256i alo, ahi;
+	spread_avx2(_mm256_sub_epi32(ff, _mm256_srli_epi32(s, 24)), &alo, &ahi);
+	__m256i lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), alo));
+	__m256i hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ahi));
+	_mm256_storeu_si256((__m256i *) (dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+    blend_tail(dst, src, i, count);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(uint32_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+    if (dst > src && dst < src + count) {
+	memmove(dst, src, count * sizeof *dst);
+	return;
+    }
+    for (; i + 8 <= count; i += 8)
+	_mm256_storeu_si256((__m256i *) (dst + i), _mm256_loadu_si256((const __m256i *) (src + i)));
+    for (; i < count; i++)
+	dst[i] = src[i];
+}
+
+__attribute__((target("avx2")))
+static void fill16_avx2(uint16_t *dst, uint16_t color, int count)
+{
+    __m256i c = _mm256_set1_epi16(color);
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+	_mm256_storeu_si256((__m256i *) (dst + i), c);
+    for (; i < count; i++)
+	dst[i] = color;
+}
+
+__attribute__((target("avx2")))
+static void copy16_avx2(uint16_t *dst, const uint16_t *src, int count)
+{
+    int i = 0;
+    if (dst > src && dst < src + count) {
+	memmove(dst, src, count * sizeof *dst);
+	return;
+    }
+    for (; i + 16 <= count; i += 16)
+	_mm256_storeu_si256((__m256i *) (dst + i), _mm256_loadu_si256((const __m256i *) (src + i)));
+    for (; i < count; i++)
+	dst[i] = src[i];
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rgb565_avx2(__m256i p)
+{
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xf800));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07e0));
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001f));
+    return _mm256_sub_epi32(_mm256_or_si256(_mm256_or_si256(r, g), b), _mm256_set1_epi32(0x8000));
+}
+
+__attribute__((target("avx2")))
+static void to_rgb565_avx2(uint16_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+	__m256i lo = rgb565_avx2(_mm256_loadu_si256((const __m256i *) (src + i)));
+	__m256i hi = rgb565_avx2(_mm256_loadu_si256((const __m256i *) (src + i + 8)));
+	/* packs は 128bit lane ごとに混ざるので並べ直す。 */
+	__m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+	_mm256_storeu_si256((__m256i *) (dst + i), _mm256_add_epi16(p, _mm256_set1_epi16(-0x8000)));
+    }
+    for (; i < count; i++)
+	dst[i] = rgb565(src[i]);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i yuv_channel_avx2(__m256i cy, __m256i de, __m256i coef)
+{
+    return _mm256_srai_epi32(_mm256_add_epi32(cy, _mm256_madd_epi16(de, coef)), 8);
+}
+
+__attribute__((target("avx2")))
+static void yuv420_avx2(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v, int count)
+{
+    __m256i one = _mm256_set1_epi16(1), c128 = _mm256_set1_epi16(128);
+    int i = 0;
+    
+    for (; i + 16 <= count; i += 16) {
+	__m128i u8 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (u + i / 2)));
+	__m128i v8 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (v + i / 2)));
+	__m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + i)));
+	__m256i d16 = _mm256_sub_epi16(_mm256_set_m128i(_mm_unpackhi_epi16(u8, u8), _mm_unpacklo_epi16(u8, u8)), c128);
+	__m256i e16 = _mm256_sub_epi16(_mm256_set_m128i(_mm_unpackhi_epi16(v8, v8), _mm_unpacklo_epi16(v8, v8)), c128);
+	
+	/* lane 0 は 0..3 と 4..7、lane 1 は 8..11 と 12..15。packs で元の順に戻る。 */
+	__m256i cylo = _mm256_madd_epi16(_mm256_unpacklo_epi16(y16, one), _mm256_set1_epi32(YUV_COEF(298, 128 - 16 * 298)));
+	__m256i cyhi = _mm256_madd_epi16(_mm256_unpackhi_epi16(y16, one), _mm256_set1_epi32(YUV_COEF(298, 128 - 16 * 298)));
+	__m256i delo = _mm256_unpacklo_epi16(d16, e16), dehi = _mm256_unpackhi_epi16(d16, e16);
+	__m256i kr = _mm256_set1_epi32(YUV_COEF(0, 409));
+	__m256i kg = _mm256_set1_epi32(YUV_COEF(-100, -208));
+	__m256i kb = _mm256_set1_epi32(YUV_COEF(516, 0));
+	__m256i r = _mm256_packs_epi32(yuv_channel_avx2(cylo, delo, kr), yuv_channel_avx2(cyhi, dehi, kr));
+	__m256i g = _mm256_packs_epi32(yuv_channel_avx2(cylo, delo, kg), yuv_channel_avx2(cyhi, dehi, kg));
+	__m256i b = _mm256_packs_epi32(yuv_channel_avx2(cylo, delo, kb), yuv_channel_avx2(cyhi, dehi, kb));
+	__m256i bg = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b), _mm256_packus_epi16(g, g));
+	__m256i ra = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r), _mm256_set1_epi8(-1));
+	__m256i lo = _mm256_unpacklo_epi16(bg, ra), hi = _mm256_unpackhi_epi16(bg, ra);
+	_mm256_storeu_si256((__m256i *) (dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i *) (dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    yuv420_tail(dst, y, u, v, i, count);
+}
+
+static const struct paint_kernels kernels_avx2 = {
+    "avx2", fill_avx2, gradient_avx2, alpha_ramp_avx2, blend_avx2, copy_avx2,
+    fill16_avx2, copy16_avx2, to_rgb565_avx2, yuv420_avx2,
+};
+
+/* AVX-512 (F + BW) */
+
+__attribute__((target("avx512f")))
+static void fill_avx512(uint32_t *dst, uint32_t color, int count)
+{
+    __m512i c = _mm512_set1_epi32(color);
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+	_mm512_storeu_si512(dst + i, c);
+    if (i < count)
+	_mm512_mask_storeu_epi32(dst + i, (__mmask16) ((1u << (count - i)) - 1), c);
+}
+
+__attribute__((target("avx512f")))
+static void gradient_avx512(uint32_t *dst, uint32_t c0, uint32_t c1, int count)
+{
+    int32_t base[4], step[4];
+    __m512i acc[4], inc[4];
+    __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    int i = 0;
+    
+    ramp_setup(c0, c1, count, base, step);
+    for (int ch = 0; ch < 4; ch++) {
+	acc[ch] = _mm512_add_epi32(_mm512_set1_epi32(base[ch]),
+		_mm512_mullo_epi32(lane, _mm512_set1_epi32(step[ch])));
+	inc[ch] = _mm512_set1_epi32(step[ch] * 16);
+    }
+    for (; i + 16 <= count; i += 16) {
+	__m512i p = _mm512_srli_epi32(acc[0], 16);
+	p = _mm512_or_si512(p, _mm512_slli_epi32(_mm512_srli_epi32(acc[1], 16), 8));
+	p = _mm512_or_si512(p, _mm512_slli_epi32(_mm512_srli_epi32(acc[2], 16), 16));
+	p = _mm512_or_si512(p, _mm512_slli_epi32(_mm512_srli_epi32(acc[3], 16), 24));
+	_mm512_storeu_si512(dst + i, p);
+	for (int ch = 0; ch < 4; ch++)
+	    acc[ch] = _mm512_add_epi32(acc[ch], inc[ch]);
+    }
+    gradient_tail(dst, base, step, i, count);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void spread_avx512(__m512i a, __m512i *lo, __m512i *hi)
+{
+    a = _mm512_or_si512(a, _mm512_slli_epi32(a, 16));
+    *lo = _mm512_unpacklo_epi32(a, a);
+    *hi = _mm512_unpackhi_epi32(a, a);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i div255_avx512(__m512i t)
+{
+    t = _mm512_add_epi16(t, _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void alpha_ramp_avx512(uint32_t *dst, int a0, int a1, int count)
+{
+    int32_t base[4], step[4];
+    __m512i zero = _mm512_setzero_si512();
+    int i = 0;
+    
+    ramp_setup(a0, a1, count, base, step);
+    __m512i acc = _mm512_add_epi32(_mm512_set1_epi32(base[0]),
+	    _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+		    _mm512_set1_epi32(step[0])));
+    __m512i inc = _mm512_set1_epi32(step[0] * 16);
+    for (; i + 16 <= count; i += 16) {
+	__m512i d = _mm512_loadu_si512(dst + i);
+	__m512i alo, ahi;
+	spread_avx512(_mm512_srli_epi32(acc, 16), &alo, &ahi);
+	__m512i lo = div255_avx512(_mm512_mullo_epi16(_mm512_unpacklo_epi8(d, zero), alo));
+	__m512i hi = div255_avx512(_mm512_mullo_epi16(_mm512_unpackhi_epi8(d, zero), ahi));
+	_mm512_storeu_si512(dst + i, _mm512_packus_epi16(lo, hi));
+	acc = _mm512_add_epi32(acc, inc);
+    }
+    alpha_ramp_tail(dst, base[0], step[0], i, count);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void blend_avx512(uint32_t *dst, const uint32_t *src, int count)
+{
+    __m512i zero = _mm512_setzero_si512();
+    __m512i ff = _mm512_set1_epi32(255);
+    int i = 0;
+    
+    for (; i + 16 <= count; i += 16) {
+	__m512i s = _mm512_loadu_si512(src + i);
+	__m512i d = _mm512_loadu_si512(dst + i);
+	__m512i alo, ahi;
+	spread_avx512(_mm512_sub_epi32(ff, _mm512_srli_epi32(s, 24)), &alo, &ahi);
+	__m512i lo = div255_avx512(_mm512_mullo_epi16(_mm512_unpacklo_epi8(d, zero), alo));
+	__m512i hi = div255_avx512(_mm512_mullo_epi16(_mm512_unpackhi_epi8(d, zero), ahi));
+	_mm512_storeu_si512(dst + i, _mm512_adds_epu8(s, _mm512_packus_epi16(lo, hi)));
+    }
+    blend_tail(dst, src, i, count);
+}
+
+__attribute__((target("avx512f")))
+static void copy_avx512(uint32_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+    if (dst > src && dst < src + count) {
+	memmove(dst, src, count * sizeof *dst);
+	return;
+    }
+    for (; i + 16 <= count; i += 16)
+	_mm512_storeu_si512(dst + i, _mm512_loadu_si512(src + i));
+    if (i < count) {
+	__mmask16 m = (1u << (count - i)) - 1;
+	_mm512_mask_storeu_epi32(dst + i, m, _mm512_maskz_loadu_epi32(m, src + i));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void fill16_avx512(uint16_t *dst, uint16_t color, int count)
+{
+    __m512i c = _mm512_set1_epi16(color);
+    int i = 0;
+    for (; i + 32 <= count; i += 32)
+	_mm512_storeu_si512(dst + i, c);
+    if (i < count)
+	_mm512_mask_storeu_epi16(dst + i, (__mmask32) ((1ull << (count - i)) - 1), c);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void copy16_avx512(uint16_t *dst, const uint16_t *src, int count)
+{
+    int i = 0;
+    if (dst > src && dst < src + count) {
+	memmove(dst, src, count * sizeof *dst);
+	return;
+    }
+    for (; i + 32 <= count; i += 32)
+	_mm512_storeu_si512(dst + i, _mm512_loadu_si512(src + i));
+    if (i < count) {
+	__mmask32 m = (1ull << (count - i)) - 1;
+	_mm512_mask_storeu_epi16(dst + i, m, _mm512_maskz_loadu_epi16(m, src + i));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void to_rgb565_avx512(uint16_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+	__m512i p = _mm512_loadu_si512(src + i);
+	__m512i r = _mm512_and_si512(_mm512_srli_epi32(p, 8), _mm512_set1_epi32(0xf800));
+	__m512i g = _mm512_and_si512(_mm512_srli_epi32(p, 5), _mm512_set1_epi32(0x07e0));
+	__m512i b = _mm512_and_si512(_mm512_srli_epi32(p, 3), _mm512_set1_epi32(0x001f));
+	p = _mm512_or_si512(_mm512_or_si512(r, g), b);
+	_mm256_storeu_si256((__m256i *) (dst + i), _mm512_cvtepi32_epi16(p));
+    }
+    for (; i < count; i++)
+	dst[i] = rgb565(src[i]);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i yuv_channel_avx512(__m512i cy, __m512i de, __m512i coef)
+{
+    return _mm512_srai_epi32(_mm512_add_epi32(cy, _mm512_madd_epi16(de, coef)), 8);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void yuv420_avx512(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v, int count)
+{
+    __m512i one = _mm512_set1_epi16(1), c128 = _mm512_set1_epi16(128);
+    /* u, v を 2 ピクセルずつに広げる */
+    __m512i dup = _mm512_set_epi16(15, 15, 14, 14, 13, 13, 12, 12, 11, 11, 10, 10, 9, 9, 8, 8,
+	    7, 7, 6, 6, 5, 5, 4, 4, 3, 3, 2, 2, 1, 1, 0, 0);
+    /* lane ごとに処理した結果を元の順に並べる (64bit 単位) */
+    __m512i order0 = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    __m512i order1 = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    int i = 0;
+    
+    for (; i + 32 <= count; i += 32) {
+	__m512i y16 = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (y + i)));
+	__m512i u16 = _mm512_cvtepu8_epi16(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (u + i / 2))));
+	__m512i v16 = _mm512_cvtepu8_epi16(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (v + i / 2))));
+	__m512i d16 = _mm512_sub_epi16(_mm512_permutexvar_epi16(dup, u16), c128);
+	__m512i e16 = _mm512_sub_epi16(_mm512_permutexvar_epi16(dup, v16), c128);
+	
+	__m512i cylo = _mm512_madd_epi16(_mm512_unpacklo_epi16(y16, one), _mm512_set1_epi32(YUV_COEF(298, 128 - 16 * 298)));
+	__m512i cyhi = _mm512_madd_epi16(_mm512_unpackhi_epi16(y16, one), _mm512_set1_epi32(YUV_COEF(298, 128 - 16 * 298)));
+	__m512i delo = _mm512_unpacklo_epi16(d16, e16), dehi = _mm512_unpackhi_epi16(d16, e16);
+	__m512i kr = _mm512_set1_epi32(YUV_COEF(0, 409));
+	__m512i kg = _mm512_set1_epi32(YUV_COEF(-100, -208));
+	__m512i kb = _mm512_set1_epi32(YUV_COEF(516, 0));
+	__m512i r = _mm512_packs_epi32(yuv_channel_avx512(cylo, delo, kr), yuv_channel_avx512(cyhi, dehi, kr));
+	__m512i g = _mm512_packs_epi32(yuv_channel_avx512(cylo, delo, kg), yuv_channel_avx512(cyhi, dehi, kg));
+	__m512i b = _mm512_packs_epi32(yuv_channel_avx512(cylo, delo, kb), yuv_channel_avx512(cyhi, dehi, kb));
+	__m512i bg = _mm512_unpacklo_epi8(_mm512_packus_epi16(b, b), _mm512_packus_epi16(g, g));
+	__m512i ra = _mm512_unpacklo_epi8(_mm512_packus_epi16(r, r), _mm512_set1_epi8(-1));
+	__m512i lo = _mm512_unpacklo_epi16(bg, ra), hi = _mm512_unpackhi_epi16(bg, ra);
+	_mm512_storeu_si512(dst + i, _mm512_permutex2var_epi64(lo, order0, hi));
+	_mm512_storeu_si512(dst + i + 16, _mm512_permutex2var_epi64(lo, order1, hi));
+    }
+    yuv420_tail(dst, y, u, v, i, count);
+}
+
+static const struct paint_kernels kernels_avx512 = {
+    "avx512", fill_avx512, gradient_avx512, alpha_ramp_avx512, blend_avx512, copy_avx512,
+    fill16_avx512, copy16_avx512, to_rgb565_avx512, yuv420_avx512,
+};
+
+#endif
+
+const struct paint_kernels *paint = &kernels_c;
+
+/* 使える実装を速い順に並べる。 */
+static int available_kernels(const struct paint_kernels **list)
+{
+    int n = 0;
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+	list[n++] = &kernels_avx512;
+    if (__builtin_cpu_supports("avx2"))
+	list[n++] = &kernels_avx2;
+    if (__builtin_cpu_supports("sse2"))
+	list[n++] = &kernels_sse2;
+#endif
+    list[n++] = &kernels_c;
+    return n;
+}
+
+void paint_init(void)
+{
+    const struct paint_kernels *list[4];
+    int n = available_kernels(list);
+    const char *want = getenv("WLTEST_KERNELS");
+    
+    paint = list[0];
+    if (want) {
+	for (int i = 0; i < n; i++) {
+	    if (strcmp(list[i]->name, want) == 0)
+		paint = list[i];
+	}
+    }
+    fprintf(stderr, "paint kernels: %s.\n", paint->name);
+}
+
+static int compare(const char *kname, const char *what, int count, const uint32_t *ref, const uint32_t *got)
+{
+    for (int i = 0; i < count; i++) {
+	if (ref[i] != got[i]) {
+	    fprintf(stderr, "%s: %s: count=%d [%d] %08x != %08x.\n",
+		    kname, what, count, i, got[i], ref[i]);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static int compare16(const char *kname, const char *what, int count, const uint16_t *ref, const uint16_t *got)
+{
+    for (int i = 0; i < count; i++) {
+	if (ref[i] != got[i]) {
+	    fprintf(stderr, "%s: %s: count=%d [%d] %04x != %04x.\n",
+		    kname, what, count, i, got[i], ref[i]);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* 全実装を scalar と突き合わせる。不一致の数を返す。 */
+int paint_self_test(void)
+{
+    enum { MAX = 1000, OFFSET = 3 };
+    const struct paint_kernels *list[4];
+    int n = available_kernels(list);
+    static uint32_t src[MAX + OFFSET], init[MAX + OFFSET], ref[MAX + OFFSET], got[MAX + OFFSET];
+    static uint16_t ref16[MAX + OFFSET], got16[MAX + OFFSET];
+    static uint8_t yuv[3][MAX + OFFSET];
+    int failed = 0;
+    
+    srand(1);
+    for (int i = 0; i < MAX + OFFSET; i++) {
+	src[i] = (uint32_t) rand() << 16 ^ rand();
+	init[i] = (uint32_t) rand() << 16 ^ rand();
+    }
+    /* blend の src は premultiplied として正しいものと、そうでないものを混ぜる。 */
+    for (int i = 0; i < MAX + OFFSET; i += 2)
+	src[i] &= 0xff3f3f3f;
+    for (int i = 0; i < MAX + OFFSET; i++) {
+	for (int p = 0; p < 3; p++)
+	    yuv[p][i] = rand();
+    }
+    
+    for (int k = 0; k < n; k++) {
+	const struct paint_kernels *kn = list[k];
+	int before = failed;
+	for (int count = 0; count <= MAX; count = count < 70 ? count + 1 : count * 3 / 2) {
+	    for (int off = 0; off < OFFSET; off++) {
+		uint32_t c0 = src[count % MAX], c1 = init[count % MAX];
+		int a0 = c0 & 0xff, a1 = c1 >> 24;
+		
+		memcpy(ref, init, sizeof ref);
+		memcpy(got, init, sizeof got);
+		kernels_c.fill(ref + off, c0, count);
+		kn->fill(got + off, c0, count);
+		failed += compare(kn->name, "fill", count + OFFSET, ref, got);
+		
+		kernels_c.gradient(ref + off, c0, c1, count);
+		kn->gradient(got + off, c0, c1, count);
+		failed += compare(kn->name, "gradient", count + OFFSET, ref, got);
+		
+		memcpy(ref, init, sizeof ref);
+		memcpy(got, init, sizeof got);
+		kernels_c.alpha_ramp(ref + off, a0, a1, count);
+		kn->alpha_ramp(got + off, a0, a1, count);
+		failed += compare(kn->name, "alpha_ramp", count + OFFSET, ref, got);
+		
+		kernels_c.blend(ref + off, src + OFFSET - off, count);
+		kn->blend(got + off, src + OFFSET - off, count);
+		failed += compare(kn->name, "blend", count + OFFSET, ref, got);
+		
+		kernels_c.copy(ref + off, src + off, count);
+		kn->copy(got + off, src + off, count);
+		failed += compare(kn->name, "copy", count + OFFSET, ref, got);
+		
+		memset(ref16, 0, sizeof ref16);
+		memset(got16, 0, sizeof got16);
+		kernels_c.fill16(ref16 + off, c0, count);
+		kn->fill16(got16 + off, c0, count);
+		failed += compare16(kn->name, "fill16", count + OFFSET, ref16, got16);
+		
+		kernels_c.to_rgb565(ref16 + off, src + OFFSET - off, count);
+		kn->to_rgb565(got16 + off, src + OFFSET - off, count);
+		failed += compare16(kn->name, "to_rgb565", count + OFFSET, ref16, got16);
+		
+		kernels_c.copy16(ref16 + off, (uint16_t *) init + off, count);
+		kn->copy16(got16 + off, (uint16_t *) init + off, count);
+		failed += compare16(kn->name, "copy16", count + OFFSET, ref16, got16);
+		
+		kernels_c.yuv420(ref + off, yuv[0] + off, yuv[1] + count % 7, yuv[2] + off, count);
+		kn->yuv420(got + off, yuv[0] + off, yuv[1] + count % 7, yuv[2] + off, count);
+		failed += compare(kn->name, "yuv420", count + OFFSET, ref, got);
+	    }
+	}
+	fprintf(stderr, "%s: %s.\n", kn->name, failed != before ? "FAILED" : "ok");
+    }
+    return failed;
+}
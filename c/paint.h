@@ -0,0 +1,49 @@
+#ifndef PAINT_H
+#define PAINT_H
+
+#include <stdint.h>
+
+/*
+ * ARGB8888/XRGB8888 (premultiplied) と RGB565 の 1 行分を塗るカーネル。
+ * count はピクセル数。
+ */
+struct paint_kernels {
+    const char *name;
+    void (*fill)(uint32_t *dst, uint32_t color, int count);
+    void (*gradient)(uint32_t *dst, uint32_t c0, uint32_t c1, int count);
+    void (*alpha_ramp)(uint32_t *dst, int a0, int a1, int count);
+    void (*blend)(uint32_t *dst, const uint32_t *src, int count);
+    void (*copy)(uint32_t *dst, const uint32_t *src, int count);
+    
+    void (*fill16)(uint16_t *dst, uint16_t color, int count);
+    void (*copy16)(uint16_t *dst, const uint16_t *src, int count);
+    void (*to_rgb565)(uint16_t *dst, const uint32_t *src, int count);
+    
+    /* YUV 4:2:0 の 1 行を XRGB8888 に。u, v は (count + 1) / 2 個。 */
+    void (*yuv420)(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v, int count);
+};
+
+static inline uint16_t rgb565(uint32_t argb)
+{
+    return (argb >> 8 & 0xf800) | (argb >> 5 & 0x07e0) | (argb >> 3 & 0x001f);
+}
+
+/* BT.601 limited range。SIMD 版も同じ整数の式で計算する。 */
+static inline uint32_t yuv_pixel(int y, int u, int v)
+{
+    int c = (y - 16) * 298 + 128, d = u - 128, e = v - 128;
+    int r = (c + 409 * e) >> 8;
+    int g = (c - 100 * d - 208 * e) >> 8;
+    int b = (c + 516 * d) >> 8;
+    r = r < 0 ? 0 : r > 255 ? 255 : r;
+    g = g < 0 ? 0 : g > 255 ? 255 : g;
+    b = b < 0 ? 0 : b > 255 ? 255 : b;
+    return 0xff000000 | r << 16 | g << 8 | b;
+}
+
+extern const struct paint_kernels *paint;
+
+void paint_init(void);
+int paint_self_test(void);
+
+#endif
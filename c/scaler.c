@@ -0,0 +1,105 @@
+/*
+ * 塗る時間から描く解像度を決める。時間は面積にほぼ比例するので、
+ * scale の 2 乗で見積もる。下げるのは早く、上げるのはゆっくり。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "scaler.h"
+
+#define DOWN_FRAMES 8		/* これだけ続けて budget を超えたら下げる */
+#define UP_FRAMES 60		/* これだけ続けて余裕があったら上げる */
+#define DOWN_TARGET 80		/* 下げるときは budget のこの % に収める */
+#define UP_LIMIT 70		/* 上げた後の見積もりがこの % 以下なら上げる */
+
+void scaler_init(struct scaler *s, uint64_t budget)
+{
+    s->budget = budget;
+    s->scale = SCALE_ONE;
+    s->average = 0;
+    s->over = s->under = 0;
+}
+
+/* scale が a から b になったときの時間の見積もり */
+static uint64_t estimate(uint64_t t, int a, int b)
+{
+    return t * b * b / (a * a);
+}
+
+/*
+ * pixels 画素を塗るのに ns かかったフレームを足す。damage で塗る量は
+ * フレームごとに違うので、画素あたりの時間から frame_pixels を全部
+ * 塗ったときの時間に直して見積もる。scale を変えたら 1 を返す。
+ */
+int scaler_update(struct scaler *s, uint64_t ns, uint64_t pixels, uint64_t frame_pixels)
+{
+    int scale = s->scale;
+    
+    if (pixels == 0)
+	return 0;
+    uint64_t frame_ns = ns * frame_pixels / pixels;
+    s->average = s->average ? (s->average * 7 + frame_ns) / 8 : frame_ns;
+    if (s->average > s->budget) {
+	s->under = 0;
+	if (++s->over >= DOWN_FRAMES && scale > SCALE_MIN) {
+	    do
+		scale--;
+	    while (scale > SCALE_MIN &&
+		    estimate(s->average, s->scale, scale) * 100 > s->budget * DOWN_TARGET);
+	}
+    } else if (scale < SCALE_ONE &&
+	    estimate(s->average, scale, scale + 1) * 100 <= s->budget * UP_LIMIT) {
+	s->over = 0;
+	if (++s->under >= UP_FRAMES)
+	    scale++;
+    } else
+	s->over = s->under = 0;
+    
+    if (scale == s->scale)
+	return 0;
+    s->scale = scale;
+    s->average = 0;
+    s->over = s->under = 0;
+    return 1;
+}
+
+/*
+ * SCALE_ONE で全部塗ると budget の load 倍かかる重さで、damage のように
+ * 大きさによらず同じくらいの画素だけを ±10% の揺れ付きで塗らせる。
+ * scale が動かなくなったところで budget に収まり、一つ上げると上げる
+ * 条件を満たさないことを確かめる。load は続けて変えるので、下げる方と
+ * 上げる方の両方を通る。失敗の数を返す。
+ */
+int scaler_self_test(void)
+{
+    static const double loads[] = { 0.5, 3, 20, 1.5, 0.5, 8 };
+    const uint64_t budget = 10000000;
+    const int width = 1920, height = 1080;
+    struct scaler s;
+    int failed = 0;
+    
+    srand(1);
+    scaler_init(&s, budget);
+    for (int i = 0; i < (int) (sizeof loads / sizeof loads[0]); i++) {
+	double full = loads[i] * budget, per_pixel = full / ((double) width * height);
+	int changes = 0;
+	for (int frame = 0; frame < 3000; frame++) {
+	    uint64_t frame_pixels = (uint64_t) (width * s.scale / SCALE_ONE) * (height * s.scale / SCALE_ONE);
+	    uint64_t pixels = 64 * 64 * (4 + rand() % 5);
+	    double noise = 0.9 + 0.2 * rand() / RAND_MAX;
+	    if (scaler_update(&s, pixels * per_pixel * noise, pixels, frame_pixels) && frame >= 2000)
+		changes++;
+	}
+	
+	int scale = s.scale;
+	double cost = full * scale * scale / (SCALE_ONE * SCALE_ONE);
+	double up = full * (scale + 1) * (scale + 1) / (SCALE_ONE * SCALE_ONE);
+	if (changes || (cost > budget && scale > SCALE_MIN) ||
+		(scale < SCALE_ONE && up * 100 <= budget * UP_LIMIT * 0.9)) {
+	    fprintf(stderr, "scaler: load %.1f: scale %d/%d, %.1f ms per frame, %d changes at the end.\n",
+		    loads[i], scale, SCALE_ONE, cost / 1e6, changes);
+	    failed++;
+	}
+    }
+    fprintf(stderr, "scaler: %s.\n", failed ? "FAILED" : "ok");
+    return failed;
+}
@@ -0,0 +1,21 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <stdint.h>
+
+#define SCALE_ONE 16		/* scale は SCALE_ONE 分の何か */
+#define SCALE_MIN 4
+
+/* 1 フレームを塗る時間が budget に収まるように描く解像度を決める。 */
+struct scaler {
+    uint64_t budget;		/* ns */
+    int scale;
+    uint64_t average;		/* ns。0 なら測り直し */
+    int over, under;
+};
+
+void scaler_init(struct scaler *s, uint64_t budget);
+int scaler_update(struct scaler *s, uint64_t ns, uint64_t pixels, uint64_t frame_pixels);
+int scaler_self_test(void);
+
+#endif
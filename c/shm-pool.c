@@ -0,0 +1,234 @@
+/*
+ * 伸びる shm pool。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+#include "os-compatibility.h"
+#include "shm-pool.h"
+
+#define PAGE_SIZE 4096
+#define SLAB_MAX (256 * 1024)	/* これ以下の大きさは SLAB_OBJECTS 個ずつまとめて切り出す */
+#define SLAB_OBJECTS 8
+
+struct shm_block {
+    size_t offset, size;
+    struct shm_block *next;
+};
+
+struct shm_slab {
+    size_t offset, bytes;	/* bytes は 1 個の大きさ */
+    unsigned int busy;		/* 使っている番号の bit */
+    struct shm_slab *next;
+};
+
+/*
+ * 2^k < size <= 2^(k+1) を 2^(k-2) 刻みに切り上げる。無駄は 25% 以下。
+ * 少し違う大きさに作り直しても、返した領域にそのまま収まりやすい。
+ */
+static size_t round_size(size_t size)
+{
+    if (size <= PAGE_SIZE)
+	return PAGE_SIZE;
+    int k = 63 - __builtin_clzll(size - 1);
+    size_t quarter = (size_t) 1 << (k - 2);
+    size_t n = (size + quarter - 1) / quarter;
+    return (n * quarter + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+void shm_pool_init(struct shm_pool *p, struct wl_shm *shm, size_t size, int hugepage)
+{
+    size = (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    
+    p->fd = os_create_anonymous_file(size);
+    if (p->fd < 0) {
+	fprintf(stderr, "creating a buffer file for %zu B failed: %m\n", size);
+	exit(1);
+    }
+    p->data = os_map_anonymous_file(p->fd, size, hugepage);
+    if (p->data == MAP_FAILED) {
+	fprintf(stderr, "mmap failed: %m\n");
+	exit(1);
+    }
+    p->pool = wl_shm_create_pool(shm, p->fd, size);
+    p->size = size;
+    p->used = 0;
+    p->allocated = 0;
+    p->hugepage = hugepage;
+    p->nr_grows = 0;
+    p->free = NULL;
+    p->slabs = NULL;
+}
+
+void shm_pool_fini(struct shm_pool *p)
+{
+    while (p->free) {
+	struct shm_block *b = p->free;
+	p->free = b->next;
+	free(b);
+    }
+    while (p->slabs) {
+	struct shm_slab *slab = p->slabs;
+	p->slabs = slab->next;
+	free(slab);
+    }
+    wl_shm_pool_destroy(p->pool);
+    munmap(p->data, p->size);
+    close(p->fd);
+}
+
+/* wl_shm_pool は縮められないので伸ばすだけ。mmap は動くことがある。 */
+static void grow(struct shm_pool *p, size_t need)
+{
+    size_t size = p->size * 2;
+    while (size < need)
+	size *= 2;
+    
+    if (os_resize_anonymous_file(p->fd, size) < 0) {
+	fprintf(stderr, "growing the buffer file to %zu B failed: %m\n", size);
+	exit(1);
+    }
+    void *data = os_remap_anonymous_file(p->data, p->size, size, p->hugepage);
+    if (data == MAP_FAILED) {
+	fprintf(stderr, "mremap failed: %m\n");
+	exit(1);
+    }
+    wl_shm_pool_resize(p->pool, size);
+    p->data = data;
+    p->size = size;
+    p->nr_grows++;
+}
+
+/* 空きの中で一番小さく収まるものから切り出し、無ければ末尾に足す。 */
+static size_t alloc_extent(struct shm_pool *p, size_t bytes)
+{
+    struct shm_block **best = NULL;
+    size_t offset;
+    
+    for (struct shm_block **link = &p->free; *link; link = &(*link)->next)
+	if ((*link)->size >= bytes && (best == NULL || (*link)->size < (*best)->size))
+	    best = link;
+    if (best != NULL) {
+	struct shm_block *b = *best;
+	offset = b->offset;
+	if (b->size == bytes) {
+	    *best = b->next;
+	    free(b);
+	} else {
+	    b->offset += bytes;
+	    b->size -= bytes;
+	}
+	return offset;
+    }
+    
+    if (p->used + bytes > p->size)
+	grow(p, p->used + bytes);
+    offset = p->used;
+    p->used += bytes;
+    return offset;
+}
+
+/*
+ * offset 順の位置に戻して前後とつなげる。いろいろな大きさに作り直しても
+ * 細切れにならず、pool が伸び続けない。
+ */
+static void free_extent(struct shm_pool *p, size_t offset, size_t bytes)
+{
+    struct shm_block **link = &p->free, *prev = NULL, *b;
+    
+    while (*link && (*link)->offset < offset) {
+	prev = *link;
+	link = &(*link)->next;
+    }
+    if (prev && prev->offset + prev->size == offset) {
+	prev->size += bytes;
+	b = prev;
+    } else {
+	if ((b = malloc(sizeof *b)) == NULL) {
+	    fprintf(stderr, "out of memory.\n");
+	    exit(1);
+	}
+	b->offset = offset;
+	b->size = bytes;
+	b->next = *link;
+	*link = b;
+    }
+    if (b->next && b->offset + b->size == b->next->offset) {
+	struct shm_block *next = b->next;
+	b->size += next->size;
+	b->next = next->next;
+	free(next);
+    }
+    
+    /* 末尾まで空いたら used を戻し、ページも返す。file と pool の大きさはそのまま。 */
+    if (b->offset + b->size == p->used) {
+	for (link = &p->free; *link != b; link = &(*link)->next)
+	    ;
+	*link = NULL;
+	p->used = b->offset;
+	os_release_anonymous_file(p->fd, b->offset, b->size);
+	free(b);
+    }
+}
+
+/*
+ * 確保した領域の pool 内 offset を返す。data は動くので offset で持つこと。
+ * 小さいものは同じ大きさの slab の空きから取り、無ければ slab を一つ
+ * 切り出す。小さいウィンドウがたくさんあっても、空き領域の list が
+ * 細かくならない。
+ */
+size_t shm_pool_alloc(struct shm_pool *p, size_t size)
+{
+    size_t bytes = round_size(size);
+    struct shm_slab *slab;
+    
+    p->allocated += bytes;
+    if (bytes > SLAB_MAX)
+	return alloc_extent(p, bytes);
+    
+    for (slab = p->slabs; slab; slab = slab->next)
+	if (slab->bytes == bytes && slab->busy != (1u << SLAB_OBJECTS) - 1)
+	    break;
+    if (slab == NULL) {
+	if ((slab = malloc(sizeof *slab)) == NULL) {
+	    fprintf(stderr, "out of memory.\n");
+	    exit(1);
+	}
+	slab->offset = alloc_extent(p, bytes * SLAB_OBJECTS);
+	slab->bytes = bytes;
+	slab->busy = 0;
+	slab->next = p->slabs;
+	p->slabs = slab;
+    }
+    int i = __builtin_ctz(~slab->busy);
+    slab->busy |= 1u << i;
+    return slab->offset + bytes * i;
+}
+
+void shm_pool_free(struct shm_pool *p, size_t offset, size_t size)
+{
+    size_t bytes = round_size(size);
+    struct shm_slab **link;
+    
+    p->allocated -= bytes;
+    if (bytes > SLAB_MAX) {
+	free_extent(p, offset, bytes);
+	return;
+    }
+    
+    for (link = &p->slabs; *link; link = &(*link)->next) {
+	struct shm_slab *slab = *link;
+	if (slab->bytes != bytes || offset < slab->offset || offset >= slab->offset + bytes * SLAB_OBJECTS)
+	    continue;
+	slab->busy &= ~(1u << (offset - slab->offset) / bytes);
+	if (slab->busy == 0) {
+	    *link = slab->next;
+	    free_extent(p, slab->offset, bytes * SLAB_OBJECTS);
+	    free(slab);
+	}
+	return;
+    }
+}
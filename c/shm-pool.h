@@ -0,0 +1,41 @@
+#ifndef SHM_POOL_H
+#define SHM_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct wl_shm;
+struct wl_shm_pool;
+struct shm_block;
+struct shm_slab;
+
+/*
+ * 1 本の memfd を wl_shm_pool にして、そこからバッファを切り出す。
+ * 足りなくなったら倍々に伸ばす。返された領域は隣とまとめて offset 順に
+ * 持ち、末尾に届いたら used を戻して中身のページも返す。小さいものは
+ * 同じ大きさの slab にまとめ、slab が全部空いたら領域ごと返す。
+ */
+struct shm_pool {
+    struct wl_shm_pool *pool;
+    int fd;
+    uint8_t *data;
+    size_t size, used;
+    size_t allocated;		/* 切り出して渡している分。slab の空きは入らない */
+    int hugepage;
+    struct shm_block *free;	/* offset 順で、隣り合うものはない */
+    struct shm_slab *slabs;
+    
+    unsigned int nr_grows;
+};
+
+void shm_pool_init(struct shm_pool *p, struct wl_shm *shm, size_t size, int hugepage);
+void shm_pool_fini(struct shm_pool *p);
+size_t shm_pool_alloc(struct shm_pool *p, size_t size);
+void shm_pool_free(struct shm_pool *p, size_t offset, size_t size);
+
+static inline void *shm_pool_data(struct shm_pool *p, size_t offset)
+{
+    return p->data + offset;
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * work stealing なスレッドプール。
+ *
+ * tpool_run() は [0, count) を各スレッドに均等に配り、自分の分を先頭から
+ * 取り終えたスレッドは他のスレッドの分を末尾から半分ずつ奪う。呼んだ
+ * スレッドも worker 0 として働き、全部終わるまで戻らない。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "tpool.h"
+
+#define RANGE(b, e) ((uint64_t) (uint32_t) (b) << 32 | (uint32_t) (e))
+#define RANGE_BEGIN(r) ((int) ((r) >> 32))
+#define RANGE_END(r) ((int) (uint32_t) (r))
+
+struct worker {
+    struct tpool *pool;
+    int id;
+    pthread_t thread;
+    _Atomic uint64_t range;
+    char pad[64 - sizeof (_Atomic uint64_t)];
+};
+
+struct tpool {
+    int nr_threads;
+    struct worker *workers;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned int generation;
+    int quit;
+    
+    tpool_fn _Atomic fn;
+    void *_Atomic arg;
+    atomic_int remaining;
+};
+
+static void run_one(struct tpool *pool, int index)
+{
+    atomic_load(&pool->fn)(atomic_load(&pool->arg), index);
+    if (atomic_fetch_sub(&pool->remaining, 1) == 1) {
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static int pop(struct worker *w)
+{
+    uint64_t r = atomic_load(&w->range);
+    while (RANGE_BEGIN(r) < RANGE_END(r)) {
+	if (atomic_compare_exchange_weak(&w->range, &r, RANGE(RANGE_BEGIN(r) + 1, RANGE_END(r))))
+	    return RANGE_BEGIN(r);
+    }
+    return -1;
+}
+
+/* victim の末尾から半分奪って実行する。奪えなかったら 0。 */
+static int steal(struct worker *victim)
+{
+    uint64_t r = atomic_load(&victim->range);
+    while (RANGE_BEGIN(r) < RANGE_END(r)) {
+	int b = RANGE_BEGIN(r), e = RANGE_END(r);
+	int k = (e - b + 1) / 2;
+	if (atomic_compare_exchange_weak(&victim->range, &r, RANGE(b, e - k))) {
+	    for (int i = e - k; i < e; i++)
+		run_one(victim->pool, i);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static void work(struct worker *w)
+{
+    struct tpool *pool = w->pool;
+    int i, stolen;
+    
+    do {
+	while ((i = pop(w)) >= 0)
+	    run_one(pool, i);
+	stolen = 0;
+	for (int n = 1; n < pool->nr_threads && !stolen; n++)
+	    stolen = steal(&pool->workers[(w->id + n) % pool->nr_threads]);
+    } while (stolen);
+}
+
+static void *worker_main(void *data)
+{
+    struct worker *w = data;
+    struct tpool *pool = w->pool;
+    unsigned int seen = 0;
+    
+    for (;;) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->generation == seen && !pool->quit)
+	    pthread_cond_wait(&pool->start, &pool->lock);
+	seen = pool->generation;
+	pthread_mutex_unlock(&pool->lock);
+	if (pool->quit)
+	    return NULL;
+	work(w);
+    }
+}
+
+struct tpool *tpool_create(int nr_threads)
+{
+    struct tpool *pool;
+    
+    if (nr_threads <= 0)
+	nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nr_threads <= 0)
+	nr_threads = 1;
+    
+    if ((pool = calloc(1, sizeof *pool)) == NULL)
+	return NULL;
+    if ((pool->workers = calloc(nr_threads, sizeof *pool->workers)) == NULL) {
+	free(pool);
+	return NULL;
+    }
+    pool->nr_threads = nr_threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    
+    for (int i = 0; i < nr_threads; i++) {
+	pool->workers[i].pool = pool;
+	pool->workers[i].id = i;
+	atomic_init(&pool->workers[i].range, 0);
+    }
+    for (int i = 1; i < nr_threads; i++) {
+	if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+	    fprintf(stderr, "pthread_create failed.\n");
+	    exit(1);
+	}
+    }
+    
+    return pool;
+}
+
+int tpool_threads(struct tpool *pool)
+{
+    return pool->nr_threads;
+}
+
+void tpool_run(struct tpool *pool, tpool_fn fn, void *arg, int count)
+{
+    int n = pool->nr_threads;
+    
+    if (count <= 0)
+	return;
+    
+    atomic_store(&pool->fn, fn);
+    atomic_store(&pool->arg, arg);
+    atomic_store(&pool->remaining, count);
+    for (int i = 0; i < n; i++)
+	atomic_store(&pool->workers[i].range, RANGE((int64_t) count * i / n, (int64_t) count * (i + 1) / n));
+    
+    if (n > 1) {
+	pthread_mutex_lock(&pool->lock);
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+    }
+    
+    work(&pool->workers[0]);
+    
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->remaining) > 0)
+	pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void tpool_destroy(struct tpool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int i = 1; i < pool->nr_threads; i++)
+	pthread_join(pool->workers[i].thread, NULL);
+    
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,13 @@
+#ifndef TPOOL_H
+#define TPOOL_H
+
+struct tpool;
+
+typedef void (*tpool_fn)(void *arg, int index);
+
+struct tpool *tpool_create(int nr_threads);
+int tpool_threads(struct tpool *pool);
+void tpool_run(struct tpool *pool, tpool_fn fn, void *arg, int count);
+void tpool_destroy(struct tpool *pool);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * YUV 4:2:0 の動画ファイル。全体を mmap して、先のフレームは madvise で
+ * 読み込ませておく。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "paint.h"
+#include "video.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define READAHEAD 4		/* 先読みするフレーム数 */
+#define CHUNK 256		/* 変換するときの一時領域のピクセル数 (偶数) */
+
+/* "W1280 H720 F30:1 C420jpeg ..." */
+static int parse_y4m_header(struct video *v, const char *p, const char *end)
+{
+    while (p < end && *p != '\n') {
+	char tag = *p++;
+	const char *q = p;
+	while (q < end && *q != ' ' && *q != '\n')
+	    q++;
+	switch (tag) {
+	case 'W':
+	    v->width = atoi(p);
+	    break;
+	case 'H':
+	    v->height = atoi(p);
+	    break;
+	case 'F':
+	    if (sscanf(p, "%d:%d", &v->fps_num, &v->fps_den) != 2)
+		return -1;
+	    break;
+	case 'C':
+	    /* 8bit の 4:2:0 だけ。chroma の位置の違いは無視する。 */
+	    if (!((q - p == 3 && strncmp(p, "420", 3) == 0) ||
+		    (q - p == 7 && strncmp(p, "420jpeg", 7) == 0) ||
+		    (q - p == 8 && strncmp(p, "420paldv", 8) == 0) ||
+		    (q - p == 8 && strncmp(p, "420mpeg2", 8) == 0))) {
+		fprintf(stderr, "y4m: unsupported colorspace C%.*s.\n", (int) (q - p), p);
+		return -1;
+	    }
+	    break;
+	}
+	p = q;
+	while (p < end && *p == ' ')
+	    p++;
+    }
+    return p < end ? 0 : -1;
+}
+
+/* Y4M はフレームごとに "FRAME...\n" が付くので、先に位置を拾っておく。 */
+static int index_y4m(struct video *v)
+{
+    const char *p = (const char *) v->data, *end = p + v->size;
+    const char *nl = memchr(p, '\n', v->size);
+    int max = 0;
+    
+    if (!nl || parse_y4m_header(v, p + 10, nl + 1) < 0)
+	return -1;
+    if (v->width <= 0 || v->height <= 0)
+	return -1;
+    v->frame_size = (size_t) v->width * v->height + 2 * (size_t) ((v->width + 1) / 2) * ((v->height + 1) / 2);
+    for (p = nl + 1; end - p >= 5 && memcmp(p, "FRAME", 5) == 0; ) {
+	if ((nl = memchr(p, '\n', end - p)) == NULL || (size_t) (end - nl - 1) < v->frame_size)
+	    break;
+	if (v->nr_frames == max) {
+	    max = max ? max * 2 : 256;
+	    if ((v->offsets = realloc(v->offsets, max * sizeof *v->offsets)) == NULL)
+		return -1;
+	}
+	v->offsets[v->nr_frames++] = nl + 1 - (const char *) v->data;
+	p = nl + 1 + v->frame_size;
+    }
+    return 0;
+}
+
+/* raw は "WxH[:nv12][@fps]"。 */
+static int index_raw(struct video *v, const char *raw)
+{
+    const char *fps = strchr(raw, '@');
+    
+    if (sscanf(raw, "%dx%d", &v->width, &v->height) != 2)
+	return -1;
+    if (strstr(raw, ":nv12"))
+	v->format = VIDEO_NV12;
+    if (fps)
+	v->fps_num = atoi(fps + 1);
+    v->frame_size = (size_t) v->width * v->height + 2 * (size_t) ((v->width + 1) / 2) * ((v->height + 1) / 2);
+    if (v->width <= 0 || v->height <= 0)
+	return -1;
+    v->nr_frames = v->size / v->frame_size;
+    if ((v->offsets = malloc(v->nr_frames * sizeof *v->offsets)) == NULL)
+	return -1;
+    for (int i = 0; i < v->nr_frames; i++)
+	v->offsets[i] = i * v->frame_size;
+    return 0;
+}
+
+struct video *video_open(const char *path, const char *raw)
+{
+    struct video *v = calloc(1, sizeof *v);
+    struct stat st;
+    
+    if (!v)
+	return NULL;
+    v->fps_num = 30;
+    v->fps_den = 1;
+    if ((v->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(v->fd, &st) < 0) {
+	perror(path);
+	goto fail;
+    }
+    v->size = st.st_size;
+    v->data = mmap(NULL, v->size, PROT_READ, MAP_SHARED, v->fd, 0);
+    if (v->data == MAP_FAILED) {
+	perror(path);
+	v->data = NULL;
+	goto fail;
+    }
+    madvise((void *) v->data, v->size, MADV_SEQUENTIAL);
+    
+    if (v->size >= 10 && memcmp(v->data, "YUV4MPEG2 ", 10) == 0) {
+	if (index_y4m(v) < 0)
+	    goto bad;
+    } else if (!raw || index_raw(v, raw) < 0)
+	goto bad;
+    if (v->nr_frames == 0 || v->fps_num <= 0 || v->fps_den <= 0)
+	goto bad;
+    return v;
+    
+bad:
+    fprintf(stderr, "%s: not a Y4M file or raw %s.\n", path, raw ? raw : "(no size given)");
+fail:
+    video_close(v);
+    return NULL;
+}
+
+void video_close(struct video *v)
+{
+    if (v->data)
+	munmap((void *) v->data, v->size);
+    if (v->fd >= 0)
+	close(v->fd);
+    free(v->offsets);
+    free(v);
+}
+
+static void advise(const struct video *v, int index, int count, int advice)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    
+    if (index < 0 || index >= v->nr_frames)
+	return;
+    count = MIN(count, v->nr_frames - index);
+    size_t start = v->offsets[index] & ~(page - 1);
+    size_t end = v->offsets[index + count - 1] + v->frame_size;
+    madvise((uint8_t *) v->data + start, end - start, advice);
+}
+
+/*
+ * index 番目のフレームの plane。この後のフレームを先読みさせ、もう使わない
+ * 前のフレームは page cache に残したまま mapping から外す。
+ */
+void video_frame(const struct video *v, int index, struct video_frame *f)
+{
+    size_t luma = (size_t) v->width * v->height;
+    size_t chroma = (size_t) ((v->width + 1) / 2) * ((v->height + 1) / 2);
+    
+    f->y = v->data + v->offsets[index];
+    f->u = f->y + luma;
+    f->v = v->format == VIDEO_I420 ? f->u + chroma : NULL;
+    
+    advise(v, index + 1, READAHEAD, MADV_WILLNEED);
+    if (index >= 2)
+	advise(v, index - 2, 1, MADV_DONTNEED);
+}
+
+/* y0 から y1 の行を XRGB8888 (bpp 4) か RGB565 (bpp 2) にする。 */
+void video_convert(const struct video *v, const struct video_frame *f,
+	void *data, int stride, int bpp, int y0, int y1)
+{
+    int cw = (v->width + 1) / 2;
+    uint32_t tmp[CHUNK];
+    uint8_t u[CHUNK / 2], vv[CHUNK / 2];
+    
+    for (int y = y0; y < y1; y++) {
+	const uint8_t *py = f->y + (size_t) y * v->width;
+	uint8_t *row = (uint8_t *) data + (size_t) y * stride;
+	
+	if (v->format == VIDEO_I420 && bpp == 4) {
+	    paint->yuv420((uint32_t *) row, py, f->u + (size_t) (y / 2) * cw,
+		    f->v + (size_t) (y / 2) * cw, v->width);
+	    continue;
+	}
+	for (int x = 0; x < v->width; x += CHUNK) {
+	    int n = MIN(CHUNK, v->width - x);
+	    const uint8_t *pu, *pv;
+	    if (v->format == VIDEO_NV12) {
+		const uint8_t *uv = f->u + (size_t) (y / 2) * cw * 2 + x;
+		for (int i = 0; i < (n + 1) / 2; i++) {
+		    u[i] = uv[i * 2];
+		    vv[i] = uv[i * 2 + 1];
+		}
+		pu = u;
+		pv = vv;
+	    } else {
+		pu = f->u + (size_t) (y / 2) * cw + x / 2;
+		pv = f->v + (size_t) (y / 2) * cw + x / 2;
+	    }
+	    if (bpp == 4)
+		paint->yuv420((uint32_t *) row + x, py + x, pu, pv, n);
+	    else {
+		paint->yuv420(tmp, py + x, pu, pv, n);
+		paint->to_rgb565((uint16_t *) row + x, tmp, n);
+	    }
+	}
+    }
+}
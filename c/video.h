@@ -0,0 +1,35 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum video_format {
+    VIDEO_I420,			/* Y, U, V の plane */
+    VIDEO_NV12,			/* Y と、UV を交互に並べた plane */
+};
+
+/* Y4M か raw の YUV 4:2:0 ファイルを mmap したもの。 */
+struct video {
+    int fd;
+    const uint8_t *data;
+    size_t size;
+    int width, height;
+    enum video_format format;
+    int fps_num, fps_den;
+    size_t frame_size;
+    int nr_frames;
+    size_t *offsets;		/* 各フレームの Y plane の位置 */
+};
+
+struct video_frame {
+    const uint8_t *y, *u, *v;	/* NV12 では u が UV で v は NULL */
+};
+
+struct video *video_open(const char *path, const char *raw);
+void video_close(struct video *v);
+void video_frame(const struct video *v, int index, struct video_frame *f);
+void video_convert(const struct video *v, const struct video_frame *f,
+	void *data, int stride, int bpp, int y0, int y1);
+
+#endif
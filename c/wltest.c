@@ -3,25 +3,163 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/mman.h>
-#include <sys/fcntl.h>
 #include <wayland-client.h>
 #include <wayland-client-protocol.h>
-// #include "os-compatibility.h"
+#include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "os-compatibility.h"
+#include "paint.h"
+#include "tpool.h"
+#include "damage.h"
+#include "shm-pool.h"
+#include "latency.h"
+#include "scaler.h"
+#include "video.h"
+
+#define NR_BUFFERS 3
+#define NR_SPRITE_BUFFERS 2
+#define SPRITE_SIZE 64
+#define TILE_SIZE 64
+#define MAX_DAMAGE_RECTS 32
+#define WINDOW_WIDTH 160	/* -w で開くウィンドウ */
+#define WINDOW_HEIGHT 120
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+struct options {
+    int hugepage;
+    int threads;
+    int painter;
+    int low_bandwidth;
+    const char *csv;
+    int nr_frames;
+    int layered;
+    int budget;		/* ms。0 でなければ描く解像度を変える */
+    const char *video;
+    const char *raw;		/* raw の動画の "WxH[:nv12][@fps]" */
+    int nr_windows;
+};
+
+enum {
+    FORMAT_ARGB8888,
+    FORMAT_XRGB8888,
+    FORMAT_RGB565,
+};
+
+static const struct format {
+    uint32_t format;
+    const char *name;
+    int bpp;
+    int opaque;
+} formats[] = {
+    [FORMAT_ARGB8888] = { WL_SHM_FORMAT_ARGB8888, "ARGB8888", 4, 0 },
+    [FORMAT_XRGB8888] = { WL_SHM_FORMAT_XRGB8888, "XRGB8888", 4, 1 },
+    [FORMAT_RGB565]   = { WL_SHM_FORMAT_RGB565,   "RGB565",   2, 1 },
+};
+
+struct canvas {
+    void *data;
+    int width, height;
+    int bpp;
+};
+
+struct buffer {
+    struct simple_client *client;
+    struct window *window;	/* -w のウィンドウのバッファなら */
+    struct wl_buffer *buffer;
+    size_t offset, size;
+    int width, height;
+    int busy;
+    struct damage damage;	/* このバッファで古くなっているタイル */
+};
+
+/*
+ * -w で開く小さいウィンドウ。毎フレーム全部塗る。バッファは client の
+ * shm pool から切り出すので、ウィンドウごとの fd や mmap は無い。
+ */
+struct window {
+    struct simple_client *client;
+    struct wl_surface *surface;
+    struct wl_shell_surface *shell_surface;
+    struct buffer buffers[NR_BUFFERS];
+    int wait_for_buffer;
+    uint32_t time;
+};
 
 struct simple_client {
     struct wl_display       *display;
     struct wl_registry      *registry;
     struct wl_compositor    *compositor;
-    struct wl_buffer        *buffer;
+    uint32_t                 compositor_version;
     struct wl_surface       *surface;
+    struct wl_subcompositor *subcompositor;
+    struct wl_surface       *sprite_surface;	/* -L のときだけ */
+    struct wl_subsurface    *subsurface;
     struct wl_shm           *shm;
+    uint32_t                 formats;	/* 1 << FORMAT_* */
+    const struct format     *format;
     struct wl_shell         *shell;
     struct wl_shell_surface *shell_surface;
-    void *data;
-    int width, height;
+    struct wl_callback      *frame_callback;
+    struct wl_event_queue   *render_queue;
+    struct wp_presentation  *presentation;
+    struct wp_viewporter    *viewporter;
+    struct wp_viewport      *viewport;	/* -D のときだけ */
+    clockid_t                clock_id;
+    struct buffer buffers[NR_BUFFERS];
+    struct buffer sprite_buffers[NR_SPRITE_BUFFERS];
+    struct buffer *front;
+    struct shm_pool shm_pool;
+    struct tpool *pool;
+    struct options opts;
+    int wait_for_buffer;
+    int width, height;			/* 描く大きさ (バッファの大きさ) */
+    int window_width, window_height;	/* viewport がなければ width, height と同じ */
+    struct scaler scaler;
+    
+    /* configure は main thread で来るので lock して渡す。 */
+    pthread_mutex_t lock;
+    int pending_width, pending_height;
+    
+    pthread_t render_thread;
+    int wake_fd[2];
+    volatile int quit;
+    
+    struct damage frame_damage;
+    int full_damage;
+    int *tiles;
+    
+    uint32_t time, drawn_time;
+    uint32_t frames, report_time;
+    uint64_t tiles_painted, tiles_copied, tiles_total;
+    
+    /* presentation feedback は render thread で受けるので lock は要らない。 */
+    uint32_t seq;
+    struct latency latency;
+    
+    /* -v のとき */
+    struct video *video;
+    uint64_t video_start;
+    int64_t video_due;		/* 最後に出したフレーム。-1 ならまだ */
+    uint32_t video_shown, video_dropped;
+    
+    struct window *windows;
+};
+
+/* 1 フレーム分の wp_presentation_feedback。 */
+struct feedback {
+    struct simple_client *client;
+    struct wp_presentation_feedback *feedback;
+    struct frame_times t;
 };
 
 void die(const char msg[])
@@ -39,7 +177,15 @@ static void handle_ping(void *data, struct wl_shell_surface *shell_surface, uint
 
 static void handle_configure(void *data, struct wl_shell_surface *wl_shell_surface, uint32_t edges, int32_t width, int32_t height)
 {
+    struct simple_client *client = data;
     fprintf(stderr, "configure.\n");
+    /* 次に塗るときにこの大きさにする。 */
+    if (width > 0 && height > 0) {
+	pthread_mutex_lock(&client->lock);
+	client->pending_width = width;
+	client->pending_height = height;
+	pthread_mutex_unlock(&client->lock);
+    }
 }
 
 static void handle_popup_done(void *data, struct wl_shell_surface *wl_shell_surface)
@@ -47,53 +193,90 @@ static void handle_popup_done(void *data, struct wl_shell_surface *wl_shell_surf
     fprintf(stderr, "popup_done.\n");
 }
 
+static void shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+    struct simple_client *client = data;
+    for (int i = 0; i < (int) (sizeof formats / sizeof formats[0]); i++) {
+	if (formats[i].format == format)
+	    client->formats |= 1 << i;
+    }
+}
+
+static void presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clk_id)
+{
+    struct simple_client *client = data;
+    client->clock_id = clk_id;
+}
+
 static void registry_handle_global(
     void *data, struct wl_registry *registry, uint32_t name,
     const char *interface, uint32_t version)
 {
     struct simple_client *client = data;
     printf("interface=%s name=%0x version=%d\n", interface, name, version);
-    if (strcmp(interface, "wl_compositor") == 0)
-        client->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 1);
+    if (strcmp(interface, "wl_compositor") == 0) {
+	client->compositor_version = MIN(version, 4);
+	client->compositor = wl_registry_bind(registry, name, &wl_compositor_interface,
+		client->compositor_version);
+    }
     else if (strcmp(interface, "wl_shell") == 0)
         client->shell = wl_registry_bind(registry, name, &wl_shell_interface, 1);
-    else if (strcmp(interface, "wl_shm") == 0)
+    else if (strcmp(interface, "wl_shm") == 0) {
+	static const struct wl_shm_listener shm_listener = {
+	    shm_format,
+	};
         client->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
-}
-
-static void create_shm_buffer(struct simple_client *client)
-{
-    struct wl_shm_pool *pool;
-    int fd, size, stride;
-
-    stride = client->width * 4;
-    size = stride * client->height;
-
-    fd = open("/tmp/test.buf", O_RDWR | O_CREAT | O_TRUNC);
-    if (fd < 0) {
-        fprintf(stderr, "creating a buffer file for %d B failed: %m\n", size);
-        exit(1);
+	wl_shm_add_listener(client->shm, &shm_listener, client);
     }
-    unlink("/tmp/test.buf");
-    for (int s = 0; s < size; s += 1024) {
-	static char buf[1024] = { 0, };
-	write(fd, buf, sizeof buf);
+    else if (strcmp(interface, "wl_subcompositor") == 0)
+	client->subcompositor = wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
+    else if (strcmp(interface, "wp_viewporter") == 0)
+	client->viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    else if (strcmp(interface, "wp_presentation") == 0) {
+	static const struct wp_presentation_listener presentation_listener = {
+	    presentation_clock_id,
+	};
+	client->presentation = wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+	wp_presentation_add_listener(client->presentation, &presentation_listener, client);
     }
+}
 
-    client->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (client->data == MAP_FAILED) {
-        fprintf(stderr, "mmap failed: %m\n");
-        close(fd);
-        exit(1);
-    }
+static void buffer_release(void *data, struct wl_buffer *wl_buffer);
+
+static void create_shm_buffer(struct simple_client *client, struct buffer *buffer, int width, int height)
+{
+    static const struct wl_buffer_listener buffer_listener = {
+	buffer_release,
+    };
+    int stride = width * client->format->bpp;
+    
+    buffer->width = width;
+    buffer->height = height;
+    buffer->size = (size_t) stride * height;
+    buffer->offset = shm_pool_alloc(&client->shm_pool, buffer->size);
+    buffer->buffer =
+	wl_shm_pool_create_buffer(client->shm_pool.pool, buffer->offset,
+	    width, height, stride, client->format->format);
+    /* release は render thread で受ける。attach 前なのでここで移して間に合う。 */
+    wl_proxy_set_queue((struct wl_proxy *) buffer->buffer, client->render_queue);
+    wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+    buffer->busy = 0;
+    damage_init(&buffer->damage, width, height, TILE_SIZE);
+    damage_all(&buffer->damage);
+}
 
-    pool = wl_shm_create_pool(client->shm, fd, size);
-    client->buffer =
-        wl_shm_pool_create_buffer(pool, 0,
-            client->width, client->height, stride, WL_SHM_FORMAT_ARGB8888);
-    wl_shm_pool_destroy(pool);
+static void destroy_shm_buffer(struct simple_client *client, struct buffer *buffer)
+{
+    wl_buffer_destroy(buffer->buffer);
+    shm_pool_free(&client->shm_pool, buffer->offset, buffer->size);
+    damage_fini(&buffer->damage);
+    buffer->buffer = NULL;
+}
 
-    close(fd);
+/* pool が伸びると mmap が動くので、ポインタは毎回 offset から求める。 */
+static void *buffer_data(struct simple_client *client, struct buffer *buffer)
+{
+    return shm_pool_data(&client->shm_pool, buffer->offset);
 }
 
 /*
@@ -105,48 +288,902 @@ void draw_argb8888(void *d, uint8_t a, uint8_t r, uint8_t g, uint8_t b, size_t c
 }
 */
 
-static void paint0(struct simple_client *client)
+static void *canvas_at(const struct canvas *c, int x, int y)
 {
-    int stride = client->width * 4;
-    for (int y = 0; y < client->height; y++) {
-	for (int x = 0; x < client->width; x++) {
-	    int hi = 16 * x / client->width;
-	    int lo = 16 * y / client->height;
-	    int a = hi << 4 | lo;
-	    
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 0] = 0xff;
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 1] = 0;
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 2] = 0;
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 3] = 0;
+    return (uint8_t *) c->data + ((size_t) c->width * y + x) * c->bpp;
+}
+
+/* color は ARGB8888。RGB565 のときは変換して塗る。 */
+static void fill_span(const struct canvas *c, int x, int y, uint32_t color, int count)
+{
+    if (c->bpp == 2)
+	paint->fill16(canvas_at(c, x, y), rgb565(color), count);
+    else
+	paint->fill(canvas_at(c, x, y), color, count);
+}
+
+static void copy_span(const struct canvas *dst, int dy, const struct canvas *src, int sy, int x, int count)
+{
+    if (dst->bpp == 2)
+	paint->copy16(canvas_at(dst, x, dy), canvas_at(src, x, sy), count);
+    else
+	paint->copy(canvas_at(dst, x, dy), canvas_at(src, x, sy), count);
+}
+
+/* 背景の上を跳ね回る四角。time は frame callback の ms。 */
+static void sprite_position(const struct canvas *c, uint32_t time, int *sx, int *sy)
+{
+    int w = MAX(c->width - SPRITE_SIZE, 0);
+    int h = MAX(c->height - SPRITE_SIZE, 0);
+    int x = w > 0 ? time / 4 % (2 * w) : 0;
+    int y = h > 0 ? time / 6 % (2 * h) : 0;
+    *sx = x > w ? 2 * w - x : x;
+    *sy = y > h ? 2 * h - y : y;
+}
+
+static void paint_sprite(const struct canvas *c, uint32_t time, const struct rect *clip)
+{
+    int sx, sy;
+    sprite_position(c, time, &sx, &sy);
+    int x0 = MAX(sx, clip->x0), x1 = MIN(sx + SPRITE_SIZE, clip->x1);
+    int y0 = MAX(sy, clip->y0), y1 = MIN(sy + SPRITE_SIZE, clip->y1);
+    for (int y = y0; y < y1 && x0 < x1; y++)
+	fill_span(c, x0, y, 0xffffffff, x1 - x0);
+}
+
+static void sprite_damage(const struct canvas *c, uint32_t time, struct damage *d)
+{
+    int sx, sy;
+    sprite_position(c, time, &sx, &sy);
+    damage_add(d, sx, sy, SPRITE_SIZE, SPRITE_SIZE);
+}
+
+static void paint0(const struct canvas *c, uint32_t time, const struct rect *clip)
+{
+    for (int y = clip->y0; y < clip->y1; y++)
+	fill_span(c, clip->x0, y, 0x000000ff, clip->x1 - clip->x0);
+}
+
+/* painter は背景だけを塗る。sprite は paint_tile() が上に重ねる。 */
+
+/*
+ * 16x16 の格子。a の上位は x で、下位は y で決まるので、x 方向は同じ値の
+ * 区間ごとに fill し、同じ帯に入る行は最初の行をコピーする。
+ */
+static void paint1(const struct canvas *c, uint32_t time, const struct rect *clip)
+{
+    int width = c->width, height = c->height;
+    for (int lo = 0; lo < 16; lo++) {
+	int y0 = MAX((lo * height + 15) / 16, clip->y0);
+	int y1 = MIN(((lo + 1) * height + 15) / 16, clip->y1);
+	if (y0 >= y1)
+	    continue;
+	for (int hi = 0; hi < 16; hi++) {
+	    int x0 = MAX((hi * width + 15) / 16, clip->x0);
+	    int x1 = MIN(((hi + 1) * width + 15) / 16, clip->x1);
+	    uint32_t a = hi << 4 | lo;
+	    if (x0 < x1)
+		fill_span(c, x0, y0, a << 24 | 0x0000ff, x1 - x0);
 	}
+	for (int y = y0 + 1; y < y1; y++)
+	    copy_span(c, y, c, y0, clip->x0, clip->x1 - clip->x0);
+    }
+}
+
+typedef void (*painter_t)(const struct canvas *c, uint32_t time, const struct rect *clip);
+
+/*
+ * opaque なら XRGB8888 で出す。paint0 は alpha 0 の青を ARGB8888 で出す
+ * 元からの見た目なので、alpha を捨てる XRGB8888 にはしない。
+ */
+static const struct painter {
+    painter_t paint;
+    int opaque;
+} painters[] = {
+    { paint0, 0 },
+    { paint1, 0 },
+};
+
+struct frame {
+    const struct canvas *canvas;
+    const struct canvas *prev;
+    const int *tiles;		/* 負なら ~tiles[i] を prev からコピーする */
+    uint32_t time;
+    int tiles_x;
+    painter_t paint;
+    int sprite;
+};
+
+static void paint_tile(void *arg, int index)
+{
+    struct frame *f = arg;
+    int tile = f->tiles ? f->tiles[index] : index;
+    int copy = tile < 0;
+    struct rect r;
+    
+    if (copy)
+	tile = ~tile;
+    r.x0 = tile % f->tiles_x * TILE_SIZE;
+    r.y0 = tile / f->tiles_x * TILE_SIZE;
+    r.x1 = MIN(r.x0 + TILE_SIZE, f->canvas->width);
+    r.y1 = MIN(r.y0 + TILE_SIZE, f->canvas->height);
+    
+    if (copy) {
+	for (int y = r.y0; y < r.y1; y++)
+	    copy_span(f->canvas, y, f->prev, y, r.x0, r.x1 - r.x0);
+    } else {
+	f->paint(f->canvas, f->time, &r);
+	if (f->sprite)
+	    paint_sprite(f->canvas, f->time, &r);
     }
 }
 
-static void paint1(struct simple_client *client)
+/*
+ * tiles に挙げたタイルだけ pool で塗る (NULL なら全部)。戻ったときには
+ * 全部塗り終わっている。sprite が 0 なら背景だけ。
+ */
+static void render_tiles(struct tpool *pool, painter_t painter, const struct canvas *c,
+	const struct canvas *prev, const int *tiles, int nr_tiles, uint32_t time, int sprite)
+{
+    struct frame f = {
+	c, prev, tiles, time, (c->width + TILE_SIZE - 1) / TILE_SIZE, painter, sprite,
+    };
+    tpool_run(pool, paint_tile, &f, nr_tiles);
+}
+
+static void render_frame(struct tpool *pool, painter_t painter, const struct canvas *c, uint32_t time)
+{
+    int tiles_x = (c->width + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (c->height + TILE_SIZE - 1) / TILE_SIZE;
+    render_tiles(pool, painter, c, NULL, NULL, tiles_x * tiles_y, time, 1);
+}
+
+#define VIDEO_BAND 16
+
+struct video_job {
+    const struct video *video;
+    struct video_frame frame;
+    const struct canvas *canvas;
+};
+
+static void convert_band(void *arg, int index)
+{
+    struct video_job *job = arg;
+    const struct canvas *c = job->canvas;
+    int y0 = index * VIDEO_BAND;
+    video_convert(job->video, &job->frame, c->data, c->width * c->bpp, c->bpp,
+	    y0, MIN(y0 + VIDEO_BAND, c->height));
+}
+
+/* 動画の index 番目のフレームを、VIDEO_BAND 行ずつ pool で変換する。 */
+static void render_video(struct tpool *pool, const struct video *v, int index, const struct canvas *c)
+{
+    struct video_job job = { v, { NULL, NULL, NULL }, c };
+    video_frame(v, index, &job.frame);
+    tpool_run(pool, convert_band, &job, (c->height + VIDEO_BAND - 1) / VIDEO_BAND);
+}
+
+static uint64_t clock_ns(clockid_t clock_id)
+{
+    struct timespec ts;
+    clock_gettime(clock_id, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static double now_ms(void)
 {
-    int stride = client->width * 4;
-    for (int y = 0; y < client->height; y++) {
-	for (int x = 0; x < client->width; x++) {
-	    int hi = 16 * x / client->width;
-	    int lo = 16 * y / client->height;
-	    int a = hi << 4 | lo;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* compositor が無いときに painter と -l から決める format。choose_format() と同じ考え方。 */
+static const struct format *offscreen_format(const struct options *opts, int painter)
+{
+    if (opts->low_bandwidth)
+	return &formats[FORMAT_RGB565];
+    return &formats[painters[painter].opaque ? FORMAT_XRGB8888 : FORMAT_ARGB8888];
+}
+
+/* compositor なしでメモリ上に塗って、スレッド数ごとの 1 フレームの時間を出す。 */
+static void scaling_report(painter_t painter, const struct format *format, int width, int height, int frames)
+{
+    struct canvas c = { NULL, width, height, format->bpp };
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    double base = 0;
+    
+    if ((c.data = malloc((size_t) width * height * c.bpp)) == NULL)
+	die("Cannot allocate memory for canvas\n");
+    
+    printf("%dx%d %s, %d frames, %dx%d tiles, kernels=%s\n",
+	    width, height, format->name, frames, TILE_SIZE, TILE_SIZE, paint->name);
+    printf("threads  ms/frame  speedup\n");
+    for (int n = 1; ; n = MIN(n * 2, ncpu)) {
+	struct tpool *pool = tpool_create(n);
+	render_frame(pool, painter, &c, 0);
+	double t0 = now_ms();
+	for (int i = 0; i < frames; i++)
+	    render_frame(pool, painter, &c, i * 16);
+	double ms = (now_ms() - t0) / frames;
+	if (n == 1)
+	    base = ms;
+	printf("%7d  %8.3f  %7.2f\n", n, ms, base / ms);
+	tpool_destroy(pool);
+	if (n >= ncpu)
+	    break;
+    }
+    free(c.data);
+}
+
+static void bench_line(int width, int height, const char *name, const struct format *format, double ms)
+{
+    double pixels = (double) width * height;
+    printf("%5dx%-5d  %7s  %-8s  %8.3f  %8.1f  %8.3f  %6.2f\n",
+	    width, height, name, format->name, ms, pixels / ms / 1e3,
+	    ms * 1e6 / pixels, pixels * format->bpp / ms / 1e6);
+}
+
+/* メモリ上に作った 1 フレームの動画を、-v と同じ経路で変換する。 */
+static void bench_video(struct tpool *pool, const struct options *opts,
+	enum video_format vf, int width, int height, int frames)
+{
+    const struct format *format = &formats[opts->low_bandwidth ? FORMAT_RGB565 : FORMAT_XRGB8888];
+    size_t offset = 0;
+    struct video v = {
+	-1, NULL, 0, width, height, vf, 30, 1,
+	(size_t) width * height + 2 * (size_t) ((width + 1) / 2) * ((height + 1) / 2), 1, &offset,
+    };
+    uint8_t *data = malloc(v.frame_size);
+    struct canvas c[NR_BUFFERS];
+    
+    if (!data)
+	die("Cannot allocate memory for video\n");
+    for (size_t i = 0; i < v.frame_size; i++)
+	data[i] = i * 7 + (i >> 9);
+    v.data = data;
+    v.size = v.frame_size;
+    for (int i = 0; i < NR_BUFFERS; i++) {
+	c[i] = (struct canvas) { malloc((size_t) width * height * format->bpp), width, height, format->bpp };
+	if (!c[i].data)
+	    die("Cannot allocate memory for canvas\n");
+	render_video(pool, &v, 0, &c[i]);
+    }
+    
+    double t0 = now_ms();
+    for (int i = 0; i < frames; i++)
+	render_video(pool, &v, 0, &c[i % NR_BUFFERS]);
+    bench_line(width, height, vf == VIDEO_I420 ? "i420" : "nv12", format, (now_ms() - t0) / frames);
+    
+    for (int i = 0; i < NR_BUFFERS; i++)
+	free(c[i].data);
+    free(data);
+}
+
+/*
+ * compositor なしで、全部の painter と動画の変換を NR_BUFFERS 枚のメモリ上の
+ * バッファに順番に塗る。sizes は "WxH,WxH,..."。書いたバイト数から帯域を出す。
+ */
+static void bench(const struct options *opts, const char *sizes)
+{
+    int frames = opts->nr_frames > 0 ? opts->nr_frames : 100;
+    struct tpool *pool = tpool_create(opts->threads);
+    if (!pool)
+	die("Cannot create thread pool\n");
+    
+    printf("kernels=%s, %d threads, %d frames, %dx%d tiles\n",
+	    paint->name, tpool_threads(pool), frames, TILE_SIZE, TILE_SIZE);
+    printf("size         painter  format    ms/frame    Mpix/s  ns/pixel    GB/s\n");
+    for (const char *s = sizes; *s; ) {
+	int width, height, len;
+	if (sscanf(s, "%dx%d%n", &width, &height, &len) != 2 || width <= 0 || height <= 0)
+	    die("bad size for -b\n");
+	s += len;
+	if (*s == ',')
+	    s++;
+	
+	for (int p = 0; p < (int) (sizeof painters / sizeof painters[0]); p++) {
+	    const struct format *format = offscreen_format(opts, p);
+	    size_t size = (size_t) width * height * format->bpp;
+	    struct canvas c[NR_BUFFERS];
+	    for (int i = 0; i < NR_BUFFERS; i++) {
+		c[i] = (struct canvas) { malloc(size), width, height, format->bpp };
+		if (!c[i].data)
+		    die("Cannot allocate memory for canvas\n");
+		render_frame(pool, painters[p].paint, &c[i], 0);
+	    }
+	    
+	    double t0 = now_ms();
+	    for (int i = 0; i < frames; i++)
+		render_frame(pool, painters[p].paint, &c[i % NR_BUFFERS], i * 16);
+	    char name[8];
+	    snprintf(name, sizeof name, "%d", p);
+	    bench_line(width, height, name, format, (now_ms() - t0) / frames);
 	    
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 0] = 0xff;
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 1] = 0;
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 2] = 0;
-	    ((uint8_t *) client->data)[stride * y + 4 * x + 3] = a;
+	    for (int i = 0; i < NR_BUFFERS; i++)
+		free(c[i].data);
 	}
+	for (int f = VIDEO_I420; f <= VIDEO_NV12; f++)
+	    bench_video(pool, opts, f, width, height, frames);
     }
+    tpool_destroy(pool);
 }
 
-struct simple_client *simple_client_create()
+static struct buffer *next_buffer(struct simple_client *client)
+{
+    for (int i = 0; i < NR_BUFFERS; i++) {
+	if (!client->buffers[i].busy)
+	    return &client->buffers[i];
+    }
+    return NULL;
+}
+
+/* 不透明な format なら compositor に下を blend しなくてよいと教える。 */
+static void set_opaque_region(struct simple_client *client)
+{
+    struct wl_region *region;
+    
+    if (!client->format->opaque)
+	return;
+    region = wl_compositor_create_region(client->compositor);
+    wl_region_add(region, 0, 0, client->window_width, client->window_height);
+    wl_surface_set_opaque_region(client->surface, region);
+    wl_region_destroy(region);
+}
+
+/*
+ * ウィンドウの大きさを変える。viewport があれば scaler の scale で小さく
+ * 描いて、compositor にウィンドウの大きさまで拡大してもらう。
+ */
+static void resize(struct simple_client *client, int width, int height)
+{
+    client->window_width = width;
+    client->window_height = height;
+    client->width = width;
+    client->height = height;
+    if (client->viewport) {
+	client->width = MAX(width * client->scaler.scale / SCALE_ONE, 1);
+	client->height = MAX(height * client->scaler.scale / SCALE_ONE, 1);
+	wp_viewport_set_destination(client->viewport, width, height);
+    }
+    
+    damage_fini(&client->frame_damage);
+    damage_init(&client->frame_damage, client->width, client->height, TILE_SIZE);
+    client->full_damage = 1;
+    client->front = NULL;
+    free(client->tiles);
+    client->tiles = malloc(client->frame_damage.tiles_x * client->frame_damage.tiles_y * sizeof *client->tiles);
+    if (!client->tiles)
+	die("Cannot allocate memory for tiles\n");
+    set_opaque_region(client);
+}
+
+static void apply_pending_size(struct simple_client *client)
+{
+    pthread_mutex_lock(&client->lock);
+    int width = client->pending_width, height = client->pending_height;
+    pthread_mutex_unlock(&client->lock);
+    if (width != client->window_width || height != client->window_height)
+	resize(client, width, height);
+}
+
+static int size_pending(struct simple_client *client)
+{
+    pthread_mutex_lock(&client->lock);
+    int pending = client->pending_width != client->window_width || client->pending_height != client->window_height;
+    pthread_mutex_unlock(&client->lock);
+    return pending;
+}
+
+/* 大きさの違うバッファは、空いたときに作り直す。pool の領域は使い回す。 */
+static void fit_buffer(struct simple_client *client, struct buffer *buffer)
+{
+    if (buffer->width == client->width && buffer->height == client->height)
+	return;
+    size_t pool_size = client->shm_pool.size;
+    destroy_shm_buffer(client, buffer);
+    create_shm_buffer(client, buffer, client->width, client->height);
+    if (client->shm_pool.size != pool_size)
+	fprintf(stderr, "shm pool grown to %zu KiB.\n", client->shm_pool.size / 1024);
+}
+
+static void damage_surface(struct simple_client *client, struct wl_surface *surface, const struct rect *r)
+{
+    if (client->compositor_version >= 4)
+	wl_surface_damage_buffer(surface, r->x0, r->y0, r->x1 - r->x0, r->y1 - r->y0);
+    else if (client->viewport)	/* surface 座標に直すのは面倒なので全部 */
+	wl_surface_damage(surface, 0, 0, INT32_MAX, INT32_MAX);
+    else
+	wl_surface_damage(surface, r->x0, r->y0, r->x1 - r->x0, r->y1 - r->y0);
+}
+
+static void redraw(void *data, struct wl_callback *callback, uint32_t time);
+
+/* main thread と render thread の両方の loop を止める。 */
+static void stop(struct simple_client *client)
+{
+    client->quit = 1;
+    if (write(client->wake_fd[1], "", 1) < 0)
+	perror("write");
+}
+
+static void feedback_done(struct feedback *fb)
+{
+    struct simple_client *client = fb->client;
+    
+    wp_presentation_feedback_destroy(fb->feedback);
+    free(fb);
+    if (client->opts.nr_frames > 0 &&
+	    client->latency.presented + client->latency.discarded >= (uint64_t) client->opts.nr_frames)
+	stop(client);
+}
+
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output)
+{
+}
+
+static void feedback_presented(
+    void *data, struct wp_presentation_feedback *feedback,
+    uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+    uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+    struct feedback *fb = data;
+    
+    fb->t.present = ((uint64_t) tv_sec_hi << 32 | tv_sec_lo) * UINT64_C(1000000000) + tv_nsec;
+    fb->t.refresh = refresh;
+    fb->t.msc = (uint64_t) seq_hi << 32 | seq_lo;
+    fb->t.flags = flags;
+    latency_presented(&fb->client->latency, &fb->t);
+    feedback_done(fb);
+}
+
+static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+    struct feedback *fb = data;
+    
+    latency_discarded(&fb->client->latency, &fb->t);
+    feedback_done(fb);
+}
+
+/* target は latency.h の frame_times と同じ。 */
+static void request_feedback(struct simple_client *client, struct wl_surface *surface,
+			     uint64_t paint_start, uint64_t target)
+{
+    static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output, feedback_presented, feedback_discarded,
+    };
+    struct feedback *fb = calloc(1, sizeof *fb);
+    if (!fb)
+	die("Cannot allocate memory for feedback\n");
+    
+    fb->client = client;
+    fb->t.seq = client->seq;
+    fb->t.paint = paint_start;
+    fb->t.target = target;
+    fb->t.commit = clock_ns(client->clock_id);
+    fb->feedback = wp_presentation_feedback(client->presentation, surface);
+    wl_proxy_set_queue((struct wl_proxy *) fb->feedback, client->render_queue);
+    wp_presentation_feedback_add_listener(fb->feedback, &feedback_listener, fb);
+}
+
+/* commit したフレームを数えて、5 秒ごとに報告する。 */
+static void frame_committed(struct simple_client *client, uint32_t time)
+{
+    client->drawn_time = time;
+    if (++client->seq == (uint32_t) client->opts.nr_frames && !client->presentation)
+	stop(client);
+    
+    if (client->frames++ == 0)
+	client->report_time = time;
+    else if (time - client->report_time >= 5000) {
+	fprintf(stderr, "%u frames in %u ms: %.1f fps, %.1f%% tiles painted, %.1f%% copied.\n",
+		client->frames - 1, time - client->report_time,
+		(client->frames - 1) * 1000.0 / (time - client->report_time),
+		100.0 * client->tiles_painted / MAX(client->tiles_total, 1),
+		100.0 * client->tiles_copied / MAX(client->tiles_total, 1));
+	if (client->presentation)
+	    latency_report(stderr, &client->latency, 0);
+	if (client->video)
+	    fprintf(stderr, "video: %u frames shown, %u dropped.\n", client->video_shown, client->video_dropped);
+	client->frames = 1;
+	client->tiles_painted = client->tiles_copied = client->tiles_total = 0;
+	client->report_time = time;
+    }
+}
+
+static const struct wl_callback_listener frame_listener = {
+    redraw,
+};
+
+/* frame callback も render thread で受ける。commit 前なので間に合う。 */
+static void request_frame(struct simple_client *client, struct wl_surface *surface)
+{
+    client->frame_callback = wl_surface_frame(surface);
+    wl_proxy_set_queue((struct wl_proxy *) client->frame_callback, client->render_queue);
+    wl_callback_add_listener(client->frame_callback, &frame_listener, client);
+}
+
+/*
+ * -v のとき。frame callback ごとに、再生を始めてからの時間で出すべき
+ * フレームを決める。追いつけなかったフレームは飛ばし、まだ次のフレームの
+ * 時間でなければ何も attach せずに commit して次の callback を待つ。
+ */
+static void redraw_video(struct simple_client *client, uint32_t time)
+{
+    struct video *v = client->video;
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    
+    if (client->video_due < 0)
+	client->video_start = now;
+    int64_t due = (now - client->video_start) * v->fps_num / (v->fps_den * UINT64_C(1000000000));
+    if (due == client->video_due) {
+	request_frame(client, client->surface);
+	wl_surface_commit(client->surface);
+	return;
+    }
+    
+    struct buffer *buffer = next_buffer(client);
+    if (!buffer) {
+	client->wait_for_buffer = 1;
+	return;
+    }
+    client->wait_for_buffer = 0;
+    if (client->video_due >= 0 && due > client->video_due + 1)
+	client->video_dropped += due - client->video_due - 1;
+    client->video_due = due;
+    uint64_t paint_start = clock_ns(client->clock_id);
+    /* due のフレームの時刻を presentation の clock に直す */
+    uint64_t due_ns = client->video_start + due * v->fps_den * UINT64_C(1000000000) / v->fps_num;
+    uint64_t target = paint_start - (now - due_ns);
+    
+    fit_buffer(client, buffer);
+    struct canvas c = { buffer_data(client, buffer), client->width, client->height, client->format->bpp };
+    struct rect r = { 0, 0, client->width, client->height };
+    render_video(client->pool, v, due % v->nr_frames, &c);
+    
+    wl_surface_attach(client->surface, buffer->buffer, 0, 0);
+    damage_surface(client, client->surface, &r);
+    request_frame(client, client->surface);
+    if (client->presentation)
+	request_feedback(client, client->surface, paint_start, target);
+    wl_surface_commit(client->surface);
+    buffer->busy = 1;
+    client->front = buffer;
+    client->video_shown++;
+    frame_committed(client, time);
+}
+
+/*
+ * -L のとき。背景は親の surface に大きさが変わったときだけ塗って commit
+ * し、毎フレームは desync の sub-surface に sprite だけを塗って commit する。
+ * sub-surface の位置は親の state なので親も commit するが、buffer を attach
+ * しないので背景は送り直されない。
+ */
+static void redraw_layered(struct simple_client *client, uint32_t time)
+{
+    struct buffer *sprite = NULL, *background = NULL;
+    
+    for (int i = 0; i < NR_SPRITE_BUFFERS && !sprite; i++) {
+	if (!client->sprite_buffers[i].busy)
+	    sprite = &client->sprite_buffers[i];
+    }
+    int repaint = client->full_damage || size_pending(client);
+    if (repaint)
+	background = next_buffer(client);
+    if (!sprite || (repaint && !background)) {
+	client->wait_for_buffer = 1;
+	return;
+    }
+    client->wait_for_buffer = 0;
+    uint64_t paint_start = clock_ns(client->clock_id);
+    
+    if (background) {
+	apply_pending_size(client);
+	fit_buffer(client, background);
+	struct canvas c = { buffer_data(client, background), client->width, client->height, client->format->bpp };
+	struct rect r = { 0, 0, client->width, client->height };
+	int n = client->frame_damage.tiles_x * client->frame_damage.tiles_y;
+	render_tiles(client->pool, painters[client->opts.painter].paint, &c, NULL, NULL, n, time, 0);
+	client->tiles_painted += n;
+	wl_surface_attach(client->surface, background->buffer, 0, 0);
+	damage_surface(client, client->surface, &r);
+	background->busy = 1;
+	client->front = background;
+	client->full_damage = 0;
+    }
+    client->tiles_total += client->frame_damage.tiles_x * client->frame_damage.tiles_y;
+    
+    struct canvas s = { buffer_data(client, sprite), SPRITE_SIZE, SPRITE_SIZE, client->format->bpp };
+    struct rect r = { 0, 0, SPRITE_SIZE, SPRITE_SIZE };
+    paint_sprite(&s, time, &r);
+    wl_surface_attach(client->sprite_surface, sprite->buffer, 0, 0);
+    damage_surface(client, client->sprite_surface, &r);
+    request_frame(client, client->sprite_surface);
+    if (client->presentation)
+	request_feedback(client, client->sprite_surface, paint_start, 0);
+    wl_surface_commit(client->sprite_surface);
+    sprite->busy = 1;
+    
+    struct canvas window = { NULL, client->width, client->height, client->format->bpp };
+    int sx, sy;
+    sprite_position(&window, time, &sx, &sy);
+    wl_subsurface_set_position(client->subsurface, sx, sy);
+    wl_surface_commit(client->surface);
+    frame_committed(client, time);
+}
+
+static void redraw(void *data, struct wl_callback *callback, uint32_t time)
+{
+    struct simple_client *client = data;
+    struct buffer *buffer;
+    
+    if (callback)
+	wl_callback_destroy(callback);
+    client->frame_callback = NULL;
+    /* buffer が空くのを待つことになっても、release の後でこの時刻で塗る */
+    client->time = time;
+    
+    if (client->sprite_surface) {
+	redraw_layered(client, time);
+	return;
+    }
+    if (client->video) {
+	redraw_video(client, time);
+	return;
+    }
+    
+    /* compositor が全部握っているときは release を待つ。 */
+    if ((buffer = next_buffer(client)) == NULL) {
+	client->wait_for_buffer = 1;
+	return;
+    }
+    client->wait_for_buffer = 0;
+    uint64_t paint_start = clock_ns(client->clock_id);
+    
+    apply_pending_size(client);
+    fit_buffer(client, buffer);
+    
+    struct canvas c = { buffer_data(client, buffer), client->width, client->height, client->format->bpp };
+    
+    /*
+     * 今回変わったタイルは全バッファで古くなる。このバッファで古いタイルの
+     * うち、今回変わったものは塗り、そうでないものは前のバッファからコピーする。
+     */
+    damage_clear(&client->frame_damage);
+    if (client->full_damage)
+	damage_all(&client->frame_damage);
+    else {
+	sprite_damage(&c, client->drawn_time, &client->frame_damage);
+	sprite_damage(&c, time, &client->frame_damage);
+    }
+    int full = client->full_damage;
+    client->full_damage = 0;
+    for (int i = 0; i < NR_BUFFERS; i++) {
+	struct buffer *b = &client->buffers[i];
+	if (b->width == client->width && b->height == client->height)
+	    damage_or(&b->damage, &client->frame_damage);
+    }
+    
+    int n = damage_tiles(&buffer->damage, client->tiles);
+    uint64_t pixels = 0;
+    for (int i = 0; i < n; i++) {
+	struct rect r;
+	damage_tile_rect(&buffer->damage, client->tiles[i], &r);
+	pixels += (uint64_t) (r.x1 - r.x0) * (r.y1 - r.y0);
+	if (damage_test(&client->frame_damage, client->tiles[i]))
+	    client->tiles_painted++;
+	else {
+	    client->tiles[i] = ~client->tiles[i];
+	    client->tiles_copied++;
+	}
+    }
+    client->tiles_total += client->frame_damage.tiles_x * client->frame_damage.tiles_y;
+    
+    struct canvas prev = {
+	client->front ? buffer_data(client, client->front) : NULL,
+	client->width, client->height, client->format->bpp,
+    };
+    uint64_t render_start = clock_ns(client->clock_id);
+    render_tiles(client->pool, painters[client->opts.painter].paint, &c, &prev, client->tiles, n, time, 1);
+    uint64_t render_ns = clock_ns(client->clock_id) - render_start;
+    damage_clear(&buffer->damage);
+    
+    wl_surface_attach(client->surface, buffer->buffer, 0, 0);
+    struct rect rects[MAX_DAMAGE_RECTS];
+    n = damage_rects(&client->frame_damage, rects, MAX_DAMAGE_RECTS);
+    for (int i = 0; i < n; i++)
+	damage_surface(client, client->surface, &rects[i]);
+    request_frame(client, client->surface);
+    if (client->presentation)
+	request_feedback(client, client->surface, paint_start, 0);
+    wl_surface_commit(client->surface);
+    buffer->busy = 1;
+    client->front = buffer;
+    frame_committed(client, time);
+    
+    /*
+     * scaler には塗ったタイルの画素あたりの時間を渡し、全部塗ったときの
+     * 時間に直させる。大きさが変わって全部塗ったフレームは、新しい
+     * バッファに触る分いつもより重いので数えない。
+     */
+    if (client->viewport && !full &&
+	    scaler_update(&client->scaler, render_ns, pixels, (uint64_t) client->width * client->height)) {
+	resize(client, client->window_width, client->window_height);
+	fprintf(stderr, "render scale %d/%d: %dx%d.\n",
+		client->scaler.scale, SCALE_ONE, client->width, client->height);
+    }
+}
+
+static void window_redraw(void *data, struct wl_callback *callback, uint32_t time)
+{
+    static const struct wl_callback_listener window_frame_listener = {
+	window_redraw,
+    };
+    struct window *win = data;
+    struct simple_client *client = win->client;
+    struct buffer *buffer = NULL;
+    
+    if (callback)
+	wl_callback_destroy(callback);
+    win->time = time;
+    for (int i = 0; i < NR_BUFFERS && !buffer; i++) {
+	if (!win->buffers[i].busy)
+	    buffer = &win->buffers[i];
+    }
+    if (!buffer) {
+	win->wait_for_buffer = 1;
+	return;
+    }
+    win->wait_for_buffer = 0;
+    
+    struct canvas c = { buffer_data(client, buffer), buffer->width, buffer->height, client->format->bpp };
+    struct rect r = { 0, 0, buffer->width, buffer->height };
+    render_frame(client->pool, painters[client->opts.painter].paint, &c, time);
+    wl_surface_attach(win->surface, buffer->buffer, 0, 0);
+    damage_surface(client, win->surface, &r);
+    callback = wl_surface_frame(win->surface);
+    wl_proxy_set_queue((struct wl_proxy *) callback, client->render_queue);
+    wl_callback_add_listener(callback, &window_frame_listener, win);
+    wl_surface_commit(win->surface);
+    buffer->busy = 1;
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    struct buffer *buffer = data;
+    struct simple_client *client = buffer->client;
+    
+    buffer->busy = 0;
+    if (buffer->window) {
+	if (buffer->window->wait_for_buffer)
+	    window_redraw(buffer->window, NULL, buffer->window->time);
+    } else if (client->wait_for_buffer)
+	redraw(client, NULL, client->time);
+}
+
+/*
+ * 塗る内容が不透明なら XRGB8888 にして compositor の blend を省く。
+ * 帯域を減らしたいときは RGB565 にしてバイト数を半分にする。
+ */
+static const struct format *choose_format(struct simple_client *client)
+{
+    if (client->opts.low_bandwidth) {
+	if (client->formats & 1 << FORMAT_RGB565)
+	    return &formats[FORMAT_RGB565];
+	fprintf(stderr, "RGB565 is not supported by the compositor.\n");
+    }
+    if ((client->video || painters[client->opts.painter].opaque) && client->formats & 1 << FORMAT_XRGB8888)
+	return &formats[FORMAT_XRGB8888];
+    return &formats[FORMAT_ARGB8888];
+}
+
+/* sprite だけを載せる desync の sub-surface。白い sprite は不透明。 */
+static void create_sprite_layer(struct simple_client *client)
+{
+    if (!client->subcompositor)
+	die("No wl_subcompositor for -L\n");
+    client->sprite_surface = wl_compositor_create_surface(client->compositor);
+    client->subsurface = wl_subcompositor_get_subsurface(client->subcompositor,
+	    client->sprite_surface, client->surface);
+    wl_subsurface_set_desync(client->subsurface);
+    
+    struct wl_region *region = wl_compositor_create_region(client->compositor);
+    wl_region_add(region, 0, 0, SPRITE_SIZE, SPRITE_SIZE);
+    wl_surface_set_opaque_region(client->sprite_surface, region);
+    wl_region_destroy(region);
+    
+    for (int i = 0; i < NR_SPRITE_BUFFERS; i++) {
+	client->sprite_buffers[i].client = client;
+	create_shm_buffer(client, &client->sprite_buffers[i], SPRITE_SIZE, SPRITE_SIZE);
+    }
+}
+
+/* 大きさは決まっているので configure は無視する。 */
+static void window_configure(void *data, struct wl_shell_surface *wl_shell_surface, uint32_t edges, int32_t width, int32_t height)
+{
+}
+
+static void create_window(struct simple_client *client, struct window *win, int index)
+{
+    static const struct wl_shell_surface_listener window_shell_surface_listener = {
+	handle_ping, window_configure, handle_popup_done,
+    };
+    char title[32];
+    
+    win->client = client;
+    win->surface = wl_compositor_create_surface(client->compositor);
+    win->shell_surface = wl_shell_get_shell_surface(client->shell, win->surface);
+    wl_shell_surface_add_listener(win->shell_surface, &window_shell_surface_listener, win);
+    wl_shell_surface_set_toplevel(win->shell_surface);
+    snprintf(title, sizeof title, "simple-client %d", index + 1);
+    wl_shell_surface_set_title(win->shell_surface, title);
+    wl_shell_surface_set_class(win->shell_surface, "SimpleClient");
+    
+    for (int i = 0; i < NR_BUFFERS; i++) {
+	win->buffers[i].client = client;
+	win->buffers[i].window = win;
+	create_shm_buffer(client, &win->buffers[i], WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+    if (client->format->opaque) {
+	struct wl_region *region = wl_compositor_create_region(client->compositor);
+	wl_region_add(region, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+	wl_surface_set_opaque_region(win->surface, region);
+	wl_region_destroy(region);
+    }
+    window_redraw(win, NULL, 0);
+}
+
+/*
+ * -w のウィンドウを開いて、1 枚あたりにかかった時間とメモリを出す。
+ * shm はバッファに渡した分と、slab ごと pool から取った分、heap は
+ * malloc の使用量の増えた分。
+ */
+static void create_windows(struct simple_client *client)
+{
+    int n = client->opts.nr_windows;
+    size_t used = client->shm_pool.used, allocated = client->shm_pool.allocated;
+    unsigned int grows = client->shm_pool.nr_grows;
+    struct mallinfo2 m0 = mallinfo2();
+    uint64_t t0 = clock_ns(CLOCK_MONOTONIC);
+    
+    if ((client->windows = calloc(n, sizeof *client->windows)) == NULL)
+	die("Cannot allocate memory for windows\n");
+    for (int i = 0; i < n; i++)
+	create_window(client, &client->windows[i], i);
+    uint64_t t1 = clock_ns(CLOCK_MONOTONIC);
+    wl_display_roundtrip(client->display);
+    uint64_t t2 = clock_ns(CLOCK_MONOTONIC);
+    struct mallinfo2 m1 = mallinfo2();
+    
+    fprintf(stderr, "%d windows: %.1f us each to create and paint, %.1f us with the roundtrip.\n",
+	    n, (t1 - t0) / 1e3 / n, (t2 - t0) / 1e3 / n);
+    fprintf(stderr, "  per window %.1f KiB shm in buffers, %.1f KiB taken from the pool (%d KiB of pixels), %.0f B heap.\n",
+	    (double) (client->shm_pool.allocated - allocated) / 1024 / n,
+	    (double) (client->shm_pool.used - used) / 1024 / n,
+	    WINDOW_WIDTH * WINDOW_HEIGHT * client->format->bpp * NR_BUFFERS / 1024,
+	    ((double) m1.uordblks - m0.uordblks) / n);
+    fprintf(stderr, "  pool %zu KiB in buffers, %zu KiB used of %zu KiB in 1 fd, grown %u times.\n",
+	    client->shm_pool.allocated / 1024, client->shm_pool.used / 1024, client->shm_pool.size / 1024,
+	    client->shm_pool.nr_grows - grows);
+}
+
+struct simple_client *simple_client_create(const struct options *opts)
 {
     static struct wl_registry_listener registry_listener = {
         registry_handle_global, NULL
     };
-    struct simple_client *client = malloc(sizeof (struct simple_client));
+    struct simple_client *client = calloc(1, sizeof (struct simple_client));
     if (!client)
         die("Cannot allocate memory for simple_client\n");
+    client->opts = *opts;
+    client->clock_id = CLOCK_MONOTONIC;
+    client->video_due = -1;
+    if (opts->video && (client->video = video_open(opts->video, opts->raw)) == NULL)
+	exit(EXIT_FAILURE);
+    if ((client->pool = tpool_create(opts->threads)) == NULL)
+	die("Cannot create thread pool\n");
+    pthread_mutex_init(&client->lock, NULL);
+    if (pipe(client->wake_fd) < 0)
+	die("Cannot create pipe\n");
 
     client->display = wl_display_connect(NULL);
     if (!client->display)
@@ -156,17 +1193,65 @@ struct simple_client *simple_client_create()
     if (!client->registry)
         die("Cannot get registry from Wayland display\n");
     wl_registry_add_listener(client->registry, &registry_listener, client);
+    client->render_queue = wl_display_create_queue(client->display);
 
     wl_display_roundtrip(client->display);
-    wl_display_dispatch(client->display);
+    wl_display_roundtrip(client->display);	/* wl_shm.format, wp_presentation.clock_id */
+    if (!client->presentation)
+	fprintf(stderr, "no wp_presentation: latency is not measured.\n");
+    
+    FILE *csv = NULL;
+    if (opts->csv && (csv = fopen(opts->csv, "w")) == NULL) {
+	perror(opts->csv);
+	exit(EXIT_FAILURE);
+    }
+    latency_init(&client->latency, csv);
+    
+    /* ARGB8888 と XRGB8888 はどの compositor でも使える。 */
+    client->formats |= 1 << FORMAT_ARGB8888 | 1 << FORMAT_XRGB8888;
+    client->format = choose_format(client);
+    fprintf(stderr, "format: %s.\n", client->format->name);
 
-    client->width = 600;
-    client->height = 500;
+    client->width = client->window_width = client->pending_width = 600;
+    client->height = client->window_height = client->pending_height = 500;
+    if (client->video) {
+	/* 動画の大きさのまま出す。configure は無視する。 */
+	client->width = client->window_width = client->pending_width = client->video->width;
+	client->height = client->window_height = client->pending_height = client->video->height;
+	fprintf(stderr, "video: %dx%d %s, %d frames at %d/%d fps.\n",
+		client->video->width, client->video->height,
+		client->video->format == VIDEO_NV12 ? "NV12" : "I420",
+		client->video->nr_frames, client->video->fps_num, client->video->fps_den);
+    }
+    shm_pool_init(&client->shm_pool, client->shm,
+	    ((size_t) client->width * client->height +
+		    (size_t) WINDOW_WIDTH * WINDOW_HEIGHT * opts->nr_windows) *
+	    client->format->bpp * NR_BUFFERS * 5 / 4,
+	    client->opts.hugepage);
     client->surface = wl_compositor_create_surface(client->compositor);
     client->shell_surface = wl_shell_get_shell_surface(client->shell, client->surface);
+    if (opts->budget > 0) {
+	if (client->viewporter) {
+	    scaler_init(&client->scaler, opts->budget * UINT64_C(1000000));
+	    client->viewport = wp_viewporter_get_viewport(client->viewporter, client->surface);
+	    wp_viewport_set_destination(client->viewport, client->window_width, client->window_height);
+	} else
+	    fprintf(stderr, "no wp_viewporter: render at full resolution.\n");
+    }
     fprintf(stderr, "1: shell_surface=%p.\n", client->shell_surface);
 
-    create_shm_buffer(client);
+    for (int i = 0; i < NR_BUFFERS; i++) {
+	client->buffers[i].client = client;
+	create_shm_buffer(client, &client->buffers[i], client->width, client->height);
+    }
+    if (opts->layered)
+	create_sprite_layer(client);
+    damage_init(&client->frame_damage, client->width, client->height, TILE_SIZE);
+    client->full_damage = 1;
+    set_opaque_region(client);
+    client->tiles = malloc(client->frame_damage.tiles_x * client->frame_damage.tiles_y * sizeof *client->tiles);
+    if (!client->tiles)
+	die("Cannot allocate memory for tiles\n");
 
     if (client->shell_surface) {
         static struct wl_shell_surface_listener shell_surface_listener = {
@@ -184,18 +1269,192 @@ struct simple_client *simple_client_create()
     wl_shell_surface_set_title(client->shell_surface, "simple-client");
     wl_shell_surface_set_class(client->shell_surface, "SimpleClient");
 
-    // paint0(client);
-    paint1(client);
-    wl_surface_attach(client->surface, client->buffer, 0, 0);
-    wl_surface_damage(client->surface, 0, 0, client->width, client->height);
-    wl_surface_commit(client->surface);
+    redraw(client, NULL, 0);
+    if (opts->nr_windows > 0)
+	create_windows(client);
 
     return client;
 }
 
+/* default queue は NULL では渡せないので、queue が NULL なら default 用のものを呼ぶ */
+static int prepare_read(struct wl_display *display, struct wl_event_queue *queue)
+{
+    return queue ? wl_display_prepare_read_queue(display, queue) : wl_display_prepare_read(display);
+}
+
+static int dispatch_pending(struct wl_display *display, struct wl_event_queue *queue)
+{
+    return queue ? wl_display_dispatch_queue_pending(display, queue) : wl_display_dispatch_pending(display);
+}
+
+/*
+ * queue の event を読んで dispatch する。wl_display_dispatch() と違って、
+ * 他のスレッドが同時に別の queue を読んでいても待たされない。
+ * queue が NULL なら default queue。
+ * wake_fd が読めたら 0、エラーなら -1 を返す。
+ */
+static int dispatch_queue(struct simple_client *client, struct wl_event_queue *queue, int wake_fd)
+{
+    struct wl_display *display = client->display;
+    struct pollfd fds[2] = {
+	{ wl_display_get_fd(display), POLLIN, 0 },
+	{ wake_fd, POLLIN, 0 },
+    };
+    
+    while (prepare_read(display, queue) != 0) {
+	if (dispatch_pending(display, queue) < 0)
+	    return -1;
+    }
+    if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+	wl_display_cancel_read(display);
+	return -1;
+    }
+    
+    if (poll(fds, wake_fd >= 0 ? 2 : 1, -1) < 0) {
+	wl_display_cancel_read(display);
+	return errno == EINTR ? 1 : -1;
+    }
+    if (fds[0].revents & POLLIN) {
+	if (wl_display_read_events(display) < 0)
+	    return -1;
+    } else
+	wl_display_cancel_read(display);
+    if (fds[0].revents & (POLLERR | POLLHUP))
+	return -1;
+    
+    if (dispatch_pending(display, queue) < 0)
+	return -1;
+    return wake_fd >= 0 && fds[1].revents & POLLIN ? 0 : 1;
+}
+
+/* frame callback と buffer release だけを受けて塗る。 */
+static void *render_thread(void *data)
+{
+    struct simple_client *client = data;
+    
+    while (!client->quit) {
+	if (dispatch_queue(client, client->render_queue, client->wake_fd[0]) < 0)
+	    break;
+    }
+    return NULL;
+}
+
+/* main thread は default queue (shell surface の ping/configure など) を受ける。 */
+static void simple_client_run(struct simple_client *client)
+{
+    if (pthread_create(&client->render_thread, NULL, render_thread, client) != 0)
+	die("Cannot create render thread\n");
+    
+    while (!client->quit && dispatch_queue(client, NULL, client->wake_fd[0]) >= 0)
+	;
+    
+    stop(client);
+    pthread_join(client->render_thread, NULL);
+    
+    if (client->presentation)
+	latency_report(stdout, &client->latency, 1);
+    if (client->latency.csv)
+	fclose(client->latency.csv);
+    if (client->video)
+	printf("video: %u frames shown, %u dropped.\n", client->video_shown, client->video_dropped);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-HLTl] [-b WxH,...] [-c csv] [-D ms] [-j threads] [-n frames] [-p painter] [-s WxH] [-w windows]\n"
+	    "       [-v file.y4m | -v file.yuv -r WxH[:nv12][@fps]]\n", argv0);
+    fprintf(stderr, "  -H  use transparent hugepages for large buffers\n");
+    fprintf(stderr, "  -L  layered: static background once, sprite in its own sub-surface\n");
+    fprintf(stderr, "  -l  low bandwidth: use RGB565 if the compositor supports it\n");
+    fprintf(stderr, "  -T  check every paint kernel against the scalar one and the render scaler, then exit\n");
+    fprintf(stderr, "  -b  paint every painter into memory at these sizes for -n frames and exit\n");
+    fprintf(stderr, "  -c  write per-frame paint/commit/present times to this CSV file\n");
+    fprintf(stderr, "  -D  lower the render resolution when a frame takes more than this to paint\n");
+    fprintf(stderr, "  -j  paint with this many threads (default: all cores)\n");
+    fprintf(stderr, "  -n  exit after this many frames and print latency histograms\n");
+    fprintf(stderr, "  -p  0: plain, 1: 16x16 alpha grid (default)\n");
+    fprintf(stderr, "  -s  print frame time against thread count at WxH and exit\n");
+    fprintf(stderr, "  -v  play a Y4M or raw YUV 4:2:0 file (I420 unless :nv12) in a loop\n");
+    fprintf(stderr, "  -w  also open this many %dx%d windows sharing the shm pool\n", WINDOW_WIDTH, WINDOW_HEIGHT);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv)
 {
-    struct simple_client *client = simple_client_create();
-    while (wl_display_dispatch(client->display) != -1);
+    struct options opts = { 0, };
+    opts.painter = 1;
+    int c, w = 0, h = 0;
+    const char *sizes = NULL;
+    
+    paint_init();
+    while ((c = getopt(argc, argv, "HLTlb:c:D:j:n:p:r:s:v:w:")) != -1) {
+	switch (c) {
+	case 'H':
+	    opts.hugepage = 1;
+	    break;
+	case 'L':
+	    opts.layered = 1;
+	    break;
+	case 'T':
+	    exit(paint_self_test() + scaler_self_test() ? EXIT_FAILURE : EXIT_SUCCESS);
+	case 'l':
+	    opts.low_bandwidth = 1;
+	    break;
+	case 'b':
+	    sizes = optarg;
+	    break;
+	case 'c':
+	    opts.csv = optarg;
+	    break;
+	case 'D':
+	    opts.budget = atoi(optarg);
+	    break;
+	case 'j':
+	    opts.threads = atoi(optarg);
+	    break;
+	case 'n':
+	    opts.nr_frames = atoi(optarg);
+	    break;
+	case 'p':
+	    opts.painter = atoi(optarg);
+	    if (opts.painter < 0 || opts.painter >= (int) (sizeof painters / sizeof painters[0]))
+		usage(argv[0]);
+	    break;
+	case 'r':
+	    opts.raw = optarg;
+	    break;
+	case 'v':
+	    opts.video = optarg;
+	    break;
+	case 'w':
+	    opts.nr_windows = atoi(optarg);
+	    break;
+	case 's':
+	    if (sscanf(optarg, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+		usage(argv[0]);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    
+    /* -L の背景は一度しか塗らないので、解像度を変えても意味がない。 */
+    if (opts.layered && opts.budget > 0)
+	usage(argv[0]);
+    if (opts.video && (opts.layered || opts.budget > 0))
+	usage(argv[0]);
+    
+    /* -n や -p を後に書いても効くように、getopt が終わってから走らせる。 */
+    if (sizes) {
+	bench(&opts, sizes);
+	exit(EXIT_SUCCESS);
+    }
+    if (w > 0) {
+	scaling_report(painters[opts.painter].paint, offscreen_format(&opts, opts.painter), w, h, 100);
+	exit(EXIT_SUCCESS);
+    }
+    
+    struct simple_client *client = simple_client_create(&opts);
+    simple_client_run(client);
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,64 @@
+/*
+ * 単純な bump allocator。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "arena.h"
+
+#define ALIGN 64
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size, used;
+    char *data;
+};
+
+void arena_init(struct arena *a, size_t block_size)
+{
+    a->blocks = NULL;
+    a->block_size = block_size;
+    a->total = 0;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    struct arena_block *b = a->blocks;
+    size = (size + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+    
+    if (b == NULL || b->size - b->used < size) {
+	size_t bsize = size > a->block_size ? size : a->block_size;
+	if ((b = malloc(sizeof *b)) == NULL || posix_memalign((void **) &b->data, ALIGN, bsize) != 0) {
+	    fprintf(stderr, "arena: out of memory (%zu bytes).\n", bsize);
+	    exit(1);
+	}
+	b->size = bsize;
+	b->used = 0;
+	/* 大きいものだけの block は後ろに回して、今の block を使い続ける */
+	if (a->blocks != NULL && bsize > a->block_size) {
+	    b->next = a->blocks->next;
+	    a->blocks->next = b;
+	} else {
+	    b->next = a->blocks;
+	    a->blocks = b;
+	}
+	a->total += bsize;
+    }
+    
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+void arena_free(struct arena *a)
+{
+    struct arena_block *b, *next;
+    
+    for (b = a->blocks; b != NULL; b = next) {
+	next = b->next;
+	free(b->data);
+	free(b);
+    }
+    a->blocks = NULL;
+    a->total = 0;
+}
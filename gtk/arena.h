@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * 一度に確保して一度に捨てる作業用のメモリ。
+ * block_size より大きいものはそれだけで 1 block にする。
+ */
+struct arena_block;
+
+struct arena {
+    struct arena_block *blocks;
+    size_t block_size;
+    size_t total;
+};
+
+void arena_init(struct arena *a, size_t block_size);
+/* 64 byte 境界に揃える。確保できなければ終了する。 */
+void *arena_alloc(struct arena *a, size_t size);
+void arena_free(struct arena *a);
+
+#endif
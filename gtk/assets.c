@@ -0,0 +1,233 @@
+/*
+ * 背景での読み込みと、frame ごとに量を決めた upload。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "assets.h"
+
+/* 読み込み待ち。投げるのはたまにしか無いので普通の lock で */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct asset *todo_head, **todo_tail = &todo_head;
+
+/* 読み終わったもの。worker が push して GL thread が丸ごと取る。 */
+static struct asset *loaded;
+
+/* GL thread だけが触る。upload 待ちの FIFO。 */
+static struct asset *upload_head, **upload_tail = &upload_head;
+static int pending;
+
+int64_t assets_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void push_loaded(struct asset *a)
+{
+    struct asset *head = __atomic_load_n(&loaded, __ATOMIC_RELAXED);
+    do {
+	a->next = head;
+    } while (!__atomic_compare_exchange_n(&loaded, &head, a, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void *worker(void *data)
+{
+    for (;;) {
+	pthread_mutex_lock(&lock);
+	while (todo_head == NULL)
+	    pthread_cond_wait(&cond, &lock);
+	struct asset *a = todo_head;
+	if ((todo_head = a->next) == NULL)
+	    todo_tail = &todo_head;
+	pthread_mutex_unlock(&lock);
+	
+	a->load(a);
+	a->loaded = assets_clock();
+	push_loaded(a);
+    }
+    return NULL;
+}
+
+void assets_start(int nr_threads)
+{
+    for (int i = 0; i < nr_threads; i++) {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+	pthread_detach(thread);
+    }
+}
+
+void assets_load(struct asset *a)
+{
+    a->next = NULL;
+    a->stage = 0;
+    a->done = 0;
+    a->frames = 0;
+    a->queued = assets_clock();
+    pending++;
+    
+    pthread_mutex_lock(&lock);
+    *todo_tail = a;
+    todo_tail = &a->next;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+int assets_pending(void)
+{
+    return pending;
+}
+
+/*
+ * テクスチャは最初に全 level の場所を取ってから level ごとに行単位で、
+ * buffer は byte 単位で、最低でも 1 行は進める。圧縮したテクスチャは
+ * 1 level を分けて送れないので level 単位。
+ */
+static size_t upload_texture(struct asset *a, size_t budget)
+{
+    struct texture *tex = &a->tex;
+    
+    if (a->stage == 0) {
+	glGenTextures(1, &a->texture);
+	glBindTexture(GL_TEXTURE_2D, a->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		tex->nr_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (tex->bpp != 0) {
+	    for (int l = 0; l < tex->nr_levels; l++)
+		glTexImage2D(GL_TEXTURE_2D, l, tex->format, tex->levels[l].width, tex->levels[l].height, 0,
+			tex->format, GL_UNSIGNED_BYTE, NULL);
+	}
+	a->stage = 1;
+    }
+    
+    /* stage は level + 1 */
+    int l = a->stage - 1;
+    const struct texture_level *level = &tex->levels[l];
+    glBindTexture(GL_TEXTURE_2D, a->texture);
+    if (tex->bpp == 0) {
+	glCompressedTexImage2D(GL_TEXTURE_2D, l, tex->format, level->width, level->height, 0,
+		level->size, level->data);
+	a->stage++;
+	return level->size;
+    }
+    
+    size_t stride = (size_t) level->width * tex->bpp;
+    size_t rows = budget / stride;
+    if (rows == 0)
+	rows = 1;
+    if (rows > level->height - a->done)
+	rows = level->height - a->done;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, l, 0, a->done, level->width, rows, tex->format, GL_UNSIGNED_BYTE,
+	    level->data + a->done * stride);
+    if ((a->done += rows) == level->height) {
+	a->stage++;
+	a->done = 0;
+    }
+    return rows * stride;
+}
+
+static size_t upload_buffers(struct asset *a, size_t budget)
+{
+    /* stage は今の buffer の番号 */
+    struct asset_buffer *b = &a->buffers[a->stage];
+    
+    if (a->done == 0) {
+	glGenBuffers(1, &b->name);
+	glBindBuffer(b->target, b->name);
+	glBufferData(b->target, b->size, NULL, GL_STATIC_DRAW);
+    }
+    size_t size = b->size - a->done < budget ? b->size - a->done : budget;
+    glBindBuffer(b->target, b->name);
+    glBufferSubData(b->target, a->done, size, (const char *) b->data + a->done);
+    if ((a->done += size) == b->size) {
+	a->stage++;
+	a->done = 0;
+    }
+    return size;
+}
+
+static int uploaded(const struct asset *a)
+{
+    if (a->failed)
+	return 1;
+    if (a->nr_buffers == 0)
+	return a->stage == a->tex.nr_levels + 1;
+    return a->stage == a->nr_buffers;
+}
+
+/* level や buffer の切れ目で止まらずに budget を使い切る */
+static int upload_some(struct asset *a, size_t budget, size_t *used)
+{
+    size_t start = *used;
+    
+    while (!uploaded(a) && *used - start < budget) {
+	size_t left = budget - (*used - start);
+	*used += a->nr_buffers == 0 ? upload_texture(a, left) : upload_buffers(a, left);
+    }
+    return uploaded(a);
+}
+
+static void finish(struct asset *a)
+{
+    a->uploaded = assets_clock();
+    pending--;
+    if (!a->failed) {
+	printf("%s: loaded in %.1f ms, uploaded over %d frames, %.1f ms after being queued.\n",
+		a->name, (a->loaded - a->queued) / 1e6, a->frames, (a->uploaded - a->queued) / 1e6);
+    }
+    a->ready(a);
+}
+
+size_t assets_upload(size_t budget)
+{
+    /* 取り出すと新しい順なので、ひっくり返して FIFO の後ろにつなぐ */
+    struct asset *a = __atomic_exchange_n(&loaded, NULL, __ATOMIC_ACQUIRE), *list = NULL;
+    while (a != NULL) {
+	struct asset *next = a->next;
+	a->next = list;
+	list = a;
+	a = next;
+    }
+    *upload_tail = list;
+    while (*upload_tail != NULL)
+	upload_tail = &(*upload_tail)->next;
+    
+    size_t used = 0;
+    while ((a = upload_head) != NULL && used < budget) {
+	a->frames++;
+	if (!upload_some(a, budget - used, &used))
+	    break;
+	if ((upload_head = a->next) == NULL)
+	    upload_tail = &upload_head;
+	finish(a);
+    }
+    return used;
+}
+
+void asset_load_now(struct asset *a)
+{
+    a->stage = 0;
+    a->done = 0;
+    a->frames = 1;
+    a->queued = assets_clock();
+    a->load(a);
+    a->loaded = assets_clock();
+    pending++;
+    
+    size_t used = 0;
+    while (!upload_some(a, SIZE_MAX, &used))
+	;
+    finish(a);
+}
@@ -0,0 +1,56 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+#include "texcache.h"
+
+/*
+ * 読み込みは worker thread で、GL への upload は GL thread で frame の
+ * 頭に少しずつ。読み終わったものは lock-free の stack で GL thread に渡す。
+ */
+struct asset_buffer {
+    GLenum target;
+    const void *data;
+    size_t size;
+    GLuint name;
+};
+
+struct asset {
+    struct asset *next;
+    const char *name;
+    
+    /* worker thread で呼ばれる。tex か buffers を埋める。失敗したら failed。 */
+    void (*load)(struct asset *a);
+    /* upload が終わったら (失敗したときも) GL thread で呼ばれる */
+    void (*ready)(struct asset *a);
+    int failed;
+    
+    struct texture tex;
+    GLuint texture;
+    struct asset_buffer buffers[2];
+    int nr_buffers;
+    
+    /* upload の途中経過 */
+    int stage;
+    size_t done;
+    int frames;
+    int64_t queued, loaded, uploaded;	/* ns */
+};
+
+void assets_start(int nr_threads);
+/* GL thread から投げる */
+void assets_load(struct asset *a);
+/*
+ * 読み終わったものを合わせて budget byte くらいまで upload する。
+ * GL の bind を直接変えるので gl_state_invalidate() より前に呼ぶ。
+ */
+size_t assets_upload(size_t budget);
+/* 待たずにその場で全部。placeholder 用。 */
+void asset_load_now(struct asset *a);
+int assets_pending(void);
+
+int64_t assets_clock(void);
+
+#endif
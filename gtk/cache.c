@@ -0,0 +1,146 @@
+/*
+ * 前処理済みのデータを置いておく file の読み書き。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+static pthread_once_t dir_once = PTHREAD_ONCE_INIT;
+static char *dir;
+
+static void find_dir(void)
+{
+    const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char path[4096];
+    
+    if (base != NULL && base[0] == '/')
+	snprintf(path, sizeof path, "%s", base);
+    else if (home != NULL)
+	snprintf(path, sizeof path, "%s/.cache", home);
+    else
+	return;
+    mkdir(path, 0755);
+    strncat(path, "/gtktest", sizeof path - strlen(path) - 1);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+	perror(path);
+	return;
+    }
+    dir = strdup(path);
+}
+
+static int cache_path(char *path, size_t size, const char *name)
+{
+    pthread_once(&dir_once, find_dir);
+    if (dir == NULL)
+	return -1;
+    snprintf(path, size, "%s/%s", dir, name);
+    return 0;
+}
+
+uint64_t cache_hash(const void *data, size_t size, uint64_t h)
+{
+    const unsigned char *p = data;
+    
+    for (size_t i = 0; i < size; i++) {
+	h ^= p[i];
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int cache_hash_file(const char *path, uint64_t *h)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	perror(path);
+	return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+	perror(path);
+	close(fd);
+	return -1;
+    }
+    if (st.st_size > 0) {
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+	    perror(path);
+	    close(fd);
+	    return -1;
+	}
+	*h = cache_hash(p, st.st_size, *h);
+	munmap(p, st.st_size);
+    }
+    close(fd);
+    return 0;
+}
+
+void *cache_map(const char *name, size_t *size)
+{
+    char path[4096];
+    if (cache_path(path, sizeof path, name) < 0)
+	return NULL;
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+    struct stat st;
+    void *p = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+	    p = NULL;
+	*size = st.st_size;
+    }
+    close(fd);
+    return p;
+}
+
+void cache_unmap(void *p, size_t size)
+{
+    munmap(p, size);
+}
+
+int cache_write(const char *name, const void *data, size_t size)
+{
+    char path[4096], tmp[4096 + 32];
+    if (cache_path(path, sizeof path, name) < 0)
+	return -1;
+    
+    /* 同じものを別の thread が同時に書いても混ざらないように */
+    snprintf(tmp, sizeof tmp, "%s.%d.%lx", path, getpid(), (unsigned long) pthread_self());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	perror(tmp);
+	return -1;
+    }
+    const char *p = data;
+    size_t left = size;
+    while (left > 0) {
+	ssize_t n = write(fd, p, left);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror(tmp);
+	    close(fd);
+	    unlink(tmp);
+	    return -1;
+	}
+	p += n;
+	left -= n;
+    }
+    close(fd);
+    if (rename(tmp, path) < 0) {
+	perror(path);
+	unlink(tmp);
+	return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 前処理した結果を置いておく場所。$XDG_CACHE_HOME/gtktest (無ければ
+ * ~/.cache/gtktest) に key ごとに 1 file。読むときは mmap する。
+ * 書けなくても警告を出すだけで、毎回作り直すことになるだけ。
+ */
+#define CACHE_HASH_INIT 0xcbf29ce484222325ULL
+
+/* FNV-1a。h に続けて混ぜる。 */
+uint64_t cache_hash(const void *data, size_t size, uint64_t h);
+int cache_hash_file(const char *path, uint64_t *h);
+
+/* dir/name。無いか読めなければ NULL。 */
+void *cache_map(const char *name, size_t *size);
+void cache_unmap(void *p, size_t size);
+/* 一時 file に書いてから rename するので、読む側が途中を見ることは無い */
+int cache_write(const char *name, const void *data, size_t size);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * ETC1 の encoder。block ごとに分け方 (縦/横) と基準色の持ち方
+ * (individual/differential) を全部試し、部分 block ごとに誤差が一番
+ * 小さい modifier table を選ぶ。基準色は部分 block の平均を丸めたもの。
+ */
+#include <string.h>
+#include "etc1.h"
+
+static const int modifiers[8][2] = {
+    { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 },
+    { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 },
+};
+
+/* 画素の index の値 0..3 に対応する modifier */
+static inline int modifier(int table, int index)
+{
+    int m = modifiers[table][index & 1];
+    return index & 2 ? -m : m;
+}
+
+static inline int clamp255(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+struct subblock {
+    int table;
+    unsigned int indices[8];
+    long error;
+};
+
+/* base は 8 bit に広げた基準色。px は部分 block の 8 画素。 */
+static void fit_subblock(struct subblock *sb, const int base[3], const unsigned char px[8][3])
+{
+    sb->error = -1;
+    for (int t = 0; t < 8; t++) {
+	unsigned int indices[8];
+	long error = 0;
+	for (int i = 0; i < 8; i++) {
+	    long best = -1;
+	    for (int k = 0; k < 4; k++) {
+		int m = modifier(t, k);
+		long e = 0;
+		for (int c = 0; c < 3; c++) {
+		    int d = clamp255(base[c] + m) - px[i][c];
+		    e += d * d;
+		}
+		if (best < 0 || e < best) {
+		    best = e;
+		    indices[i] = k;
+		}
+	    }
+	    error += best;
+	}
+	if (sb->error < 0 || error < sb->error) {
+	    sb->error = error;
+	    sb->table = t;
+	    memcpy(sb->indices, indices, sizeof indices);
+	}
+    }
+}
+
+struct candidate {
+    int diff, flip;
+    int c0[3], c1[3];		/* 4 bit か 5 bit の値 */
+    struct subblock sb[2];
+};
+
+static long try_mode(struct candidate *cand, const unsigned char px[2][8][3], const int sum[2][3], int diff, int flip)
+{
+    int base[2][3];
+    
+    cand->diff = diff;
+    cand->flip = flip;
+    for (int c = 0; c < 3; c++) {
+	if (diff) {
+	    /* 5 bit。差は -4..3 に収まらなければこの方法は使えない */
+	    cand->c0[c] = (sum[0][c] * 31 + 4 * 255) / (8 * 255);
+	    cand->c1[c] = (sum[1][c] * 31 + 4 * 255) / (8 * 255);
+	    int d = cand->c1[c] - cand->c0[c];
+	    if (d < -4 || d > 3)
+		return -1;
+	    base[0][c] = cand->c0[c] << 3 | cand->c0[c] >> 2;
+	    base[1][c] = cand->c1[c] << 3 | cand->c1[c] >> 2;
+	} else {
+	    cand->c0[c] = (sum[0][c] * 15 + 4 * 255) / (8 * 255);
+	    cand->c1[c] = (sum[1][c] * 15 + 4 * 255) / (8 * 255);
+	    base[0][c] = cand->c0[c] << 4 | cand->c0[c];
+	    base[1][c] = cand->c1[c] << 4 | cand->c1[c];
+	}
+    }
+    fit_subblock(&cand->sb[0], base[0], px[0]);
+    fit_subblock(&cand->sb[1], base[1], px[1]);
+    return cand->sb[0].error + cand->sb[1].error;
+}
+
+/*
+ * 画素 (x, y) の index は x * 4 + y 番目の bit。flip = 0 なら左右の
+ * 2x4、flip = 1 なら上下の 4x2 に分ける。
+ */
+static void encode_block(unsigned char *dst, const unsigned char block[4][4][3])
+{
+    unsigned char px[2][2][8][3];
+    int sum[2][2][3] = { { { 0, }, }, };
+    struct candidate best, cand;
+    
+    for (int flip = 0; flip < 2; flip++) {
+	int n[2] = { 0, 0 };
+	for (int x = 0; x < 4; x++) {
+	    for (int y = 0; y < 4; y++) {
+		int s = flip ? y >= 2 : x >= 2;
+		for (int c = 0; c < 3; c++) {
+		    px[flip][s][n[s]][c] = block[y][x][c];
+		    sum[flip][s][c] += block[y][x][c];
+		}
+		n[s]++;
+	    }
+	}
+    }
+    
+    /* individual はいつでも表せるので、flip = 0 のそれを最初の候補にする */
+    long best_error = try_mode(&best, px[0], sum[0], 0, 0);
+    for (int flip = 0; flip < 2; flip++) {
+	for (int diff = 0; diff < 2; diff++) {
+	    if (!flip && !diff)
+		continue;
+	    long error = try_mode(&cand, px[flip], sum[flip], diff, flip);
+	    if (error >= 0 && error < best_error) {
+		best_error = error;
+		best = cand;
+	    }
+	}
+    }
+    
+    unsigned int hi = 0, lo = 0;
+    for (int c = 0; c < 3; c++) {
+	int shift = 24 - c * 8;
+	/* 上の byte は 0x80 以上になるので int のままでは 24 bit ずらせない */
+	if (best.diff)
+	    hi |= (unsigned int) (best.c0[c] << 3 | ((best.c1[c] - best.c0[c]) & 7)) << shift;
+	else
+	    hi |= (unsigned int) (best.c0[c] << 4 | best.c1[c]) << shift;
+    }
+    hi |= (unsigned int) best.sb[0].table << 5 | (unsigned int) best.sb[1].table << 2 |
+	    (unsigned int) best.diff << 1 | (unsigned int) best.flip;
+    
+    /* 部分 block の中の画素は上の px と同じ順番に並んでいる */
+    int n[2] = { 0, 0 };
+    for (int x = 0; x < 4; x++) {
+	for (int y = 0; y < 4; y++) {
+	    int s = best.flip ? y >= 2 : x >= 2;
+	    unsigned int index = best.sb[s].indices[n[s]++];
+	    int bit = x * 4 + y;
+	    lo |= (index >> 1) << (bit + 16) | (index & 1) << bit;
+	}
+    }
+    
+    for (int i = 0; i < 4; i++) {
+	dst[i] = hi >> (24 - i * 8);
+	dst[i + 4] = lo >> (24 - i * 8);
+    }
+}
+
+void etc1_encode(unsigned char *dst, const unsigned char *src, int width, int height, int bpp)
+{
+    size_t stride = (size_t) width * bpp;
+    
+    for (int by = 0; by < height; by += 4) {
+	for (int bx = 0; bx < width; bx += 4) {
+	    unsigned char block[4][4][3];
+	    for (int y = 0; y < 4; y++) {
+		int sy = by + y < height ? by + y : height - 1;
+		for (int x = 0; x < 4; x++) {
+		    int sx = bx + x < width ? bx + x : width - 1;
+		    memcpy(block[y][x], src + sy * stride + sx * bpp, 3);
+		}
+	    }
+	    encode_block(dst, block);
+	    dst += 8;
+	}
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef ETC1_H
+#define ETC1_H
+
+#include <stddef.h>
+
+/*
+ * ETC1 (GL_OES_compressed_ETC1_RGB8_texture) への圧縮。4x4 画素を
+ * 8 byte にする。alpha は持てないので捨てる。
+ */
+static inline size_t etc1_size(int width, int height)
+{
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+/* src は bpp byte/画素 (3 か 4) で詰めた行。端の半端な block は端を伸ばす。 */
+void etc1_encode(unsigned char *dst, const unsigned char *src, int width, int height, int bpp);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * GL のエラー報告。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include "glstate.h"
+#include "gldebug.h"
+
+#ifdef GL_DEBUG
+
+static int use_callback;
+
+/* 最後に通った CHECK_GL_ERROR() */
+static const char *last_file = "?";
+static int last_lineno;
+
+void gl_debug_check(const char *file, int lineno)
+{
+    if (use_callback) {
+	last_file = file;
+	last_lineno = lineno;
+	return;
+    }
+    
+    int err = glGetError();
+    if (err == GL_NO_ERROR)
+	return;
+    printf("%s:%d: err=0x%08x.\n", file, lineno, err);
+    exit(1);
+}
+
+static void GL_APIENTRY debug_message(GLenum source, GLenum type, GLuint id, GLenum severity,
+	GLsizei length, const GLchar *message, const void *user_data)
+{
+    /* 非同期だと場所はおおよそ。正確に知りたければ GL_DEBUG_SYNC=1 */
+    printf("%s:%d: gl: %.*s\n", last_file, last_lineno, (int) length, message);
+    if (type == GL_DEBUG_TYPE_ERROR_KHR)
+	exit(1);
+}
+
+void gl_debug_init(void)
+{
+    if (!gl_has_extension("GL_KHR_debug")) {
+	fprintf(stderr, "no GL_KHR_debug, using glGetError.\n");
+	return;
+    }
+    
+    PFNGLDEBUGMESSAGECALLBACKKHRPROC callback =
+	    (void *) eglGetProcAddress("glDebugMessageCallbackKHR");
+    PFNGLDEBUGMESSAGECONTROLKHRPROC control =
+	    (void *) eglGetProcAddress("glDebugMessageControlKHR");
+    if (callback == NULL || control == NULL)
+	return;
+    
+    callback(debug_message, NULL);
+    control(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION_KHR, 0, NULL, GL_FALSE);
+    glEnable(GL_DEBUG_OUTPUT_KHR);
+    if (getenv("GL_DEBUG_SYNC") != NULL)
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+    use_callback = 1;
+}
+
+#else
+
+void gl_debug_init(void)
+{
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef GLDEBUG_H
+#define GLDEBUG_H
+
+/*
+ * make GL_DEBUG=1 のときだけ GL のエラーを見る。
+ * KHR_debug があれば callback で受けて、CHECK_GL_ERROR() は場所を覚えるだけ。
+ * 無ければ従来どおり glGetError()。release では何も残らない。
+ */
+#ifdef GL_DEBUG
+#define CHECK_GL_ERROR() gl_debug_check(__FILE__, __LINE__)
+void gl_debug_check(const char *file, int lineno);
+#else
+#define CHECK_GL_ERROR() ((void) 0)
+#endif
+
+/* context が current になってから呼ぶ */
+void gl_debug_init(void);
+
+#endif
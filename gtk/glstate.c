@@ -0,0 +1,125 @@
+/*
+ * 冗長な GL の状態設定を省く。
+ */
+#include <string.h>
+#include "glstate.h"
+
+#define UNKNOWN ((GLuint) -1)
+
+void gl_state_invalidate(struct gl_state *s)
+{
+    s->program = UNKNOWN;
+    s->array_buffer = UNKNOWN;
+    s->element_array_buffer = UNKNOWN;
+    s->texture = UNKNOWN;
+    s->caps_known = 0;
+    s->attribs_known = 0;
+    s->issued = s->skipped = 0;
+}
+
+void gl_state_use_program(struct gl_state *s, GLuint program)
+{
+    if (s->program == program) {
+	s->skipped++;
+	return;
+    }
+    glUseProgram(program);
+    s->program = program;
+    s->issued++;
+}
+
+void gl_state_bind_buffer(struct gl_state *s, GLenum target, GLuint buffer)
+{
+    GLuint *cur = target == GL_ELEMENT_ARRAY_BUFFER ? &s->element_array_buffer : &s->array_buffer;
+    
+    if (*cur == buffer) {
+	s->skipped++;
+	return;
+    }
+    glBindBuffer(target, buffer);
+    *cur = buffer;
+    s->issued++;
+}
+
+void gl_state_bind_texture(struct gl_state *s, GLuint texture)
+{
+    if (s->texture == texture) {
+	s->skipped++;
+	return;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    s->texture = texture;
+    s->issued++;
+}
+
+static unsigned int cap_bit(GLenum cap)
+{
+    switch (cap) {
+    case GL_DEPTH_TEST:
+	return 1 << 0;
+    case GL_CULL_FACE:
+	return 1 << 1;
+    case GL_BLEND:
+	return 1 << 2;
+    case GL_SCISSOR_TEST:
+	return 1 << 3;
+    case GL_STENCIL_TEST:
+	return 1 << 4;
+    case GL_POLYGON_OFFSET_FILL:
+	return 1 << 5;
+    default:
+	return 0;
+    }
+}
+
+void gl_state_enable(struct gl_state *s, GLenum cap, int on)
+{
+    unsigned int bit = cap_bit(cap);
+    
+    if (bit != 0 && (s->caps_known & bit) && !(s->caps & bit) == !on) {
+	s->skipped++;
+	return;
+    }
+    if (on)
+	glEnable(cap);
+    else
+	glDisable(cap);
+    s->caps_known |= bit;
+    s->caps = on ? s->caps | bit : s->caps & ~bit;
+    s->issued++;
+}
+
+void gl_state_attribs(struct gl_state *s, unsigned int mask)
+{
+    for (int i = 0; i < GL_STATE_MAX_ATTRIBS; i++) {
+	unsigned int bit = 1u << i;
+	int on = (mask & bit) != 0;
+	
+	if ((s->attribs_known & bit) && !(s->attribs & bit) == !on) {
+	    /* 使っていない attrib まで数えると skip が水増しになる */
+	    if (on)
+		s->skipped++;
+	    continue;
+	}
+	if (on)
+	    glEnableVertexAttribArray(i);
+	else
+	    glDisableVertexAttribArray(i);
+	s->attribs_known |= bit;
+	s->attribs = on ? s->attribs | bit : s->attribs & ~bit;
+	s->issued++;
+    }
+}
+
+int gl_has_extension(const char *name)
+{
+    const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+    size_t len = strlen(name);
+    
+    while (ext != NULL && (ext = strstr(ext, name)) != NULL) {
+	if (ext[len] == ' ' || ext[len] == '\0')
+	    return 1;
+	ext += len;
+    }
+    return 0;
+}
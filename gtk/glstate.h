@@ -0,0 +1,35 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <GLES2/gl2.h>
+
+/* GLES2 で保証されている GL_MAX_VERTEX_ATTRIBS の最小値 */
+#define GL_STATE_MAX_ATTRIBS 8
+
+/*
+ * 最後に設定した GL の状態を覚えておいて、同じ値の再設定は GL に渡さない。
+ * GtkGLArea は同じ context で自分でも描くので、frame の頭で
+ * gl_state_invalidate() して全部「不明」に戻す。
+ */
+struct gl_state {
+    GLuint program;
+    GLuint array_buffer, element_array_buffer;
+    GLuint texture;		/* unit 0 の GL_TEXTURE_2D だけ */
+    unsigned int caps, caps_known;
+    unsigned int attribs, attribs_known;
+    
+    /* 今の frame の分 */
+    unsigned int issued, skipped;
+};
+
+void gl_state_invalidate(struct gl_state *s);
+void gl_state_use_program(struct gl_state *s, GLuint program);
+void gl_state_bind_buffer(struct gl_state *s, GLenum target, GLuint buffer);
+void gl_state_bind_texture(struct gl_state *s, GLuint texture);
+void gl_state_enable(struct gl_state *s, GLenum cap, int on);
+/* mask の bit が立っている attrib array だけを有効にする */
+void gl_state_attribs(struct gl_state *s, unsigned int mask);
+
+int gl_has_extension(const char *name);
+
+#endif
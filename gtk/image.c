@@ -0,0 +1,166 @@
+/*
+ * テクスチャ用の画像を読む。PNG は libpng で 1 行ずつ最終的な
+ * buffer に展開し、PPM は mmap してそのまま使う。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <png.h>
+#include "image.h"
+
+static int load_png(struct image *img, FILE *fp, const char *path)
+{
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    if (info == NULL) {
+	fprintf(stderr, "%s: out of memory.\n", path);
+	png_destroy_read_struct(&png, NULL, NULL);
+	return -1;
+    }
+    img->pixels = NULL;
+    if (setjmp(png_jmpbuf(png))) {
+	png_destroy_read_struct(&png, &info, NULL);
+	free(img->pixels);
+	img->pixels = NULL;
+	return -1;
+    }
+    
+    png_init_io(png, fp);
+    png_read_info(png, info);
+    
+    /* 何が来ても 8 bit の RGB か RGBA にする */
+    int color = png_get_color_type(png, info);
+    if (png_get_bit_depth(png, info) == 16)
+	png_set_strip_16(png);
+    if (color == PNG_COLOR_TYPE_PALETTE)
+	png_set_palette_to_rgb(png);
+    if (color == PNG_COLOR_TYPE_GRAY || color == PNG_COLOR_TYPE_GRAY_ALPHA)
+	png_set_gray_to_rgb(png);
+    if (png_get_valid(png, info, PNG_INFO_tRNS))
+	png_set_tRNS_to_alpha(png);
+    png_set_expand(png);
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    
+    img->width = png_get_image_width(png, info);
+    img->height = png_get_image_height(png, info);
+    img->bpp = png_get_channels(png, info);
+    img->format = img->bpp == 4 ? GL_RGBA : GL_RGB;
+    
+    size_t stride = (size_t) img->width * img->bpp;
+    if ((img->pixels = malloc(stride * img->height)) == NULL) {
+	fprintf(stderr, "%s: out of memory.\n", path);
+	png_destroy_read_struct(&png, &info, NULL);
+	return -1;
+    }
+    for (int pass = 0; pass < passes; pass++) {
+	for (int y = 0; y < img->height; y++)
+	    png_read_row(png, img->pixels + stride * y, NULL);
+    }
+    
+    png_read_end(png, NULL);
+    png_destroy_read_struct(&png, &info, NULL);
+    return 0;
+}
+
+/* P6 で maxval が 255 のものだけ。コメントも読み飛ばす。 */
+static int load_ppm(struct image *img, int fd, const char *path)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+	perror(path);
+	return -1;
+    }
+    unsigned char *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+	perror(path);
+	return -1;
+    }
+    
+    int fields[3], pos = 2;
+    for (int i = 0; i < 3; i++) {
+	for (;;) {
+	    while (pos < st.st_size && strchr(" \t\r\n", p[pos]))
+		pos++;
+	    if (pos < st.st_size && p[pos] == '#') {
+		while (pos < st.st_size && p[pos] != '\n')
+		    pos++;
+		continue;
+	    }
+	    break;
+	}
+	fields[i] = 0;
+	int start = pos;
+	while (pos < st.st_size && p[pos] >= '0' && p[pos] <= '9' && fields[i] < 1 << 20)
+	    fields[i] = fields[i] * 10 + p[pos++] - '0';
+	if (pos == start)
+	    fields[i] = -1;
+    }
+    /* maxval の後は空白 1 文字 */
+    pos++;
+    
+    if (fields[0] <= 0 || fields[1] <= 0 || fields[2] != 255 ||
+	    (size_t) st.st_size < pos + (size_t) fields[0] * fields[1] * 3) {
+	fprintf(stderr, "%s: unsupported or truncated PPM.\n", path);
+	munmap(p, st.st_size);
+	return -1;
+    }
+    
+    img->width = fields[0];
+    img->height = fields[1];
+    img->format = GL_RGB;
+    img->bpp = 3;
+    img->pixels = p + pos;
+    img->map = p;
+    img->map_size = st.st_size;
+    /* 一度に全部使うので先に読ませておく */
+    madvise(p, st.st_size, MADV_WILLNEED);
+    return 0;
+}
+
+int image_load(struct image *img, const char *path)
+{
+    unsigned char magic[8];
+    int ret = -1;
+    
+    memset(img, 0, sizeof *img);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	perror(path);
+	return -1;
+    }
+    if (pread(fd, magic, sizeof magic, 0) != sizeof magic) {
+	fprintf(stderr, "%s: too short.\n", path);
+	close(fd);
+	return -1;
+    }
+    
+    if (png_sig_cmp(magic, 0, sizeof magic) == 0) {
+	FILE *fp = fdopen(fd, "rb");
+	if (fp != NULL) {
+	    ret = load_png(img, fp, path);
+	    fclose(fp);
+	    return ret;
+	}
+	perror(path);
+    } else if (magic[0] == 'P' && magic[1] == '6') {
+	ret = load_ppm(img, fd, path);
+    } else {
+	fprintf(stderr, "%s: not a PNG or binary PPM file.\n", path);
+    }
+    close(fd);
+    return ret;
+}
+
+void image_free(struct image *img)
+{
+    if (img->map != NULL)
+	munmap(img->map, img->map_size);
+    else
+	free(img->pixels);
+    memset(img, 0, sizeof *img);
+}
@@ -0,0 +1,26 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <GLES2/gl2.h>
+
+/*
+ * glTexImage2D にそのまま渡せる形の画素。RGB は RGBA に広げずに
+ * GL_RGB のまま渡す。行は詰めてあるので unpack alignment は 1。
+ */
+struct image {
+    int width, height;
+    GLenum format;		/* GL_RGB か GL_RGBA */
+    int bpp;
+    unsigned char *pixels;
+    
+    /* PPM は mmap したものを直接指す */
+    void *map;
+    size_t map_size;
+};
+
+/* PNG か binary の PPM (P6)。失敗したら -1 でメッセージを出す。 */
+int image_load(struct image *img, const char *path);
+void image_free(struct image *img);
+
+#endif
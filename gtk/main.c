@@ -1,19 +1,19 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <gtk/gtk.h>
 #include <GLES2/gl2.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-
-#define CHECK_GL_ERROR() check_gl_error(__FILE__, __LINE__)
-static void check_gl_error(const char *file, int lineno)
-{
-    int err = glGetError();
-    if (err == GL_NO_ERROR)
-	return;
-    printf("%s:%d: err=0x%08x.\n", file, lineno, err);
-    exit(1);
-}
+#include "glstate.h"
+#include "mesh.h"
+#include "mat4.h"
+#include "texcache.h"
+#include "assets.h"
+#include "progcache.h"
+#include "gldebug.h"
 
 static const char *vertex_shader_source1 =
 	"attribute vec4 position0;\n"
@@ -78,8 +78,31 @@ static void check_compiled(int shader)
     fprintf(stdout, "Compile Succeed.\n");
 }
 
+static void check_linked(int prog)
+{
+    int status;
+    glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+	GLint length;
+	glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &length);
+	if (length) {
+	    char *buf = malloc(length);
+	    glGetProgramInfoLog(prog, length, NULL, buf);
+	    fprintf(stderr, "LinkLog: %s\n", buf);
+	}
+	exit(EXIT_FAILURE);
+    }
+}
+
 static int create_shader_program(const char *vs_src, const char *fs_src)
 {
+    gint64 t0 = g_get_monotonic_time();
+    int prog = program_cache_load(vs_src, fs_src);
+    if (prog != 0) {
+	printf("program binary loaded in %.2f ms.\n", (g_get_monotonic_time() - t0) / 1000.0);
+	return prog;
+    }
+    
     int vs = glCreateShader(GL_VERTEX_SHADER);
     int fs = glCreateShader(GL_FRAGMENT_SHADER);
     
@@ -95,298 +118,326 @@ static int create_shader_program(const char *vs_src, const char *fs_src)
     glCompileShader(fs);
     check_compiled(fs);
     
-    int prog = glCreateProgram();
+    prog = glCreateProgram();
     glAttachShader(prog, vs);
     glAttachShader(prog, fs);
     
     glLinkProgram(prog);
+    check_linked(prog);
+    printf("program compiled in %.2f ms.\n", (g_get_monotonic_time() - t0) / 1000.0);
     
+    program_cache_store(prog, vs_src, fs_src);
     return prog;
 }
 
-struct vec3 {
-    float v[3];
-};
+/*
+ * LOD は分割数を半分ずつにしたものを全部ひとつの VBO/IBO に入れておく。
+ * 大円一周を画面上で LOD_SEGMENT_PX ずつに切れる一番粗いものを選ぶ。
+ * 粗くするのは LOD_HYSTERESIS 分余裕があるときだけ。
+ */
+#define NR_LODS 4
+#define LOD_MIN_N 8
+#define LOD_SEGMENT_PX 4.0f
+#define LOD_HYSTERESIS 0.8f
 
-struct vec4 {
-    float v[4];
+struct torus_lod {
+    int n;
+    long triangles;
+    struct mesh_chunk *chunks;
+    int nr_chunks;
+    unsigned int frames;
 };
 
-struct mat4 {
-    float v[4][4];
-};
-
-static struct mat4 mat4_mul(struct mat4 s0, struct mat4 s1)
-{
-    struct mat4 d;
-    
-    for (int y = 0; y < 4; y++) {
-	for (int x = 0; x < 4; x++) {
-	    float sum = 0;
-	    for (int i = 0; i < 4; i++)
-		sum += s0.v[y][i] * s1.v[i][x];
-	    d.v[y][x] = sum;
-	}
-    }
-    
-    return d;
-}
-
-static struct vec4 mat4_mul_vec4(struct mat4 m, struct vec4 v)
-{
-    struct vec4 r;
-    for (int y = 0; y < 4; y++) {
-	float sum = 0;
-	for (int x = 0; x < 4; x++)
-	    sum += m.v[y][x] * v.v[x];
-	r.v[y] = sum;
-    }
-    return r;
-}
-
-struct vertex_t {
-    struct {
-	float x, y, z;
-    } position;
-    struct {
-	float nx, ny, nz;
-    } normal;
-    struct {
-	float u, v;
-    } texture;
-    struct {
-	float r, g, b;
-    } color;
-};
-
-#define TORUS_N 100
-#define RADIUS (3.0f)
-#define MINOR_RADIUS (1.0f)
-
-static void create_torus(uint16_t *indices, struct vertex_t *vertices)
-{
-    int idx;
-    
-    idx = 0;
-    for (int i = 0; i < TORUS_N; i++) {
-	float c = cos(2 * M_PI * i / TORUS_N);
-	float s = sin(2 * M_PI * i / TORUS_N);
-	struct mat4 rot_y = {
-	    {
-		{ c, 0, s, 0 },
-		{ 0, 1, 0, 0 },
-		{-s, 0, c, 0 },
-		{ 0, 0, 0, 1 },
-	    },
-	};
-	struct mat4 tra_x = {
-	    {
-		{ 1, 0, 0, RADIUS },
-		{ 0, 1, 0, 0 },
-		{ 0, 0, 1, 0 },
-		{ 0, 0, 0, 1 },
-	    },
-	};
-	struct mat4 m = mat4_mul(rot_y, tra_x);
-	
-	for (int j = 0; j < TORUS_N; j++) {
-	    float c0 = cos(2 * M_PI * j / TORUS_N);
-	    float s0 = sin(2 * M_PI * j / TORUS_N);
-	    struct vec4 vtx = {
-		{ MINOR_RADIUS * c0, MINOR_RADIUS * s0, 0, 1 },
-	    };
-	    struct vec4 v = mat4_mul_vec4(m, vtx);
-	    struct vec4 norm = {
-		{ c0, s0, 0, 1 },
-	    };
-	    struct vec4 n = mat4_mul_vec4(rot_y, norm);
-	    
-	    vertices[idx++] = (struct vertex_t) {
-		.position = {
-		    .x = v.v[0],
-		    .y = v.v[1],
-		    .z = v.v[2],
-		},
-		.normal = {
-		    .nx = n.v[0],
-		    .ny = n.v[1],
-		    .nz = n.v[2],
-		},
-		.texture = {
-		    .u = (float) i / TORUS_N,
-		    .v = (float) j / TORUS_N,
-		},
-		.color = {
-		    .r = (float) i / TORUS_N,
-		    .g = (float) j / TORUS_N,
-		    .b = 0,
-		},
-	    };
-	}
-    }
-    
-    idx = 0;
-    for (int i = 0; i < TORUS_N; i++) {
-	for (int j = 0; j < TORUS_N; j++) {
-	    int i0 = i * TORUS_N + j;
-	    int i1 = i * TORUS_N + (j + 1) % TORUS_N;
-	    int i2 = (i + 1) % TORUS_N * TORUS_N + j;
-	    int i3 = (i + 1) % TORUS_N * TORUS_N + (j + 1) % TORUS_N;
-	    
-	    indices[idx++] = i0;
-	    indices[idx++] = i2;
-	    indices[idx++] = i1;
-	    
-	    indices[idx++] = i2;
-	    indices[idx++] = i3;
-	    indices[idx++] = i1;
-	}
-    }
-}
-
-static void create_flat(uint16_t *indices, struct vertex_t *vertices)
-{
-    int idx;
-    
-    idx = 0;
-    vertices[idx++] = (struct vertex_t) { {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } };
-    vertices[idx++] = (struct vertex_t) { { 100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } };
-    vertices[idx++] = (struct vertex_t) { {   0, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } };
-    vertices[idx++] = (struct vertex_t) { { 100, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } };
-    vertices[idx++] = (struct vertex_t) { {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    vertices[idx++] = (struct vertex_t) { {   0, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    vertices[idx++] = (struct vertex_t) { {-100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    vertices[idx++] = (struct vertex_t) { {-100, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    vertices[idx++] = (struct vertex_t) { {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } };
-    vertices[idx++] = (struct vertex_t) { {-100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } };
-    vertices[idx++] = (struct vertex_t) { {   0,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } };
-    vertices[idx++] = (struct vertex_t) { {-100,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } };
-    vertices[idx++] = (struct vertex_t) { {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    vertices[idx++] = (struct vertex_t) { {   0,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    vertices[idx++] = (struct vertex_t) { { 100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    vertices[idx++] = (struct vertex_t) { { 100,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } };
-    
-    idx = 0;
-    indices[idx++] = 0; indices[idx++] = 1; indices[idx++] = 2;
-    indices[idx++] = 2; indices[idx++] = 1; indices[idx++] = 3;
-    indices[idx++] = 4; indices[idx++] = 5; indices[idx++] = 6;
-    indices[idx++] = 6; indices[idx++] = 5; indices[idx++] = 7;
-    indices[idx++] = 8; indices[idx++] = 9; indices[idx++] =10;
-    indices[idx++] =10; indices[idx++] = 9; indices[idx++] =11;
-    indices[idx++] =12; indices[idx++] =13; indices[idx++] =14;
-    indices[idx++] =14; indices[idx++] =13; indices[idx++] =15;
-}
-
 struct work_t {
     int inited;
+    gint64 start;
+    size_t upload_budget;
+    
+    struct gl_state gl;
+    unsigned int frames, issued, skipped;
+    gint64 report_time;
     
     struct torus_t {
 	double angle;
 	
 	int shader;
+	GLint loc_position, loc_normal, loc_color, loc_tex;
+	GLint loc_pvw, loc_rot;
+	unsigned int attribs;
+	const struct vertex_format *format;
 	GLuint vertex_buffer, index_buffer;
-	int nr_indices;
+	int n, short_indices, strip, unoptimized, no_lod, etc1;
+	GLenum mode, index_type;
+	struct torus_lod lods[NR_LODS];
+	int nr_lods, lod;
 	
+	const char *texture_path;
 	GLuint tex;
     } torus;
     
     struct background_t {
 	int shader;
+	GLint loc_position, loc_color;
+	unsigned int attribs;
 	GLuint vertex_buffer, index_buffer;
 	int nr_indices;
     } bg;
 };
 
-static void create_texture(struct torus_t *tw)
+/* location は link 直後に一度だけ引く */
+static GLint attrib_location(int prog, const char *name)
 {
-    FILE *fp;
-    if ((fp = popen("png2pnm < test.png", "r")) == NULL) {
-	perror("popen");
+    GLint loc = glGetAttribLocation(prog, name);
+    if (loc < 0 || loc >= GL_STATE_MAX_ATTRIBS) {
+	fprintf(stderr, "%s: bad attribute location %d.\n", name, loc);
 	exit(1);
     }
-    
-    char magic[3];
-    int width, height;
-    int max;
-    if (fscanf(fp, "%2s %d %d %d\n", magic, &width, &height, &max) != 4) {
-	printf("bad header.\n");
-	exit(1);
-    }
-    
-    unsigned char *data;
-    if ((data = malloc(width * height * 4)) == NULL) {
-	printf("out of memory.\n");
+    return loc;
+}
+
+static GLint uniform_location(int prog, const char *name)
+{
+    GLint loc = glGetUniformLocation(prog, name);
+    if (loc < 0) {
+	fprintf(stderr, "%s: no such uniform.\n", name);
 	exit(1);
     }
-    memset(data, 0, width * height * 4);
-    
-    for (int y = 0; y < height; y++) {
-	for (int x = 0; x < width; x++) {
-	    int r = fgetc(fp);
-	    int g = fgetc(fp);
-	    int b = fgetc(fp);
-	    if (b == EOF) {
-		printf("unexpected eof.\n");
-		exit(1);
-	    }
-	    data[(y * width + x) * 4 + 0] = r;
-	    data[(y * width + x) * 4 + 1] = g;
-	    data[(y * width + x) * 4 + 2] = b;
-	    data[(y * width + x) * 4 + 3] = 255;
-	}
-    }
-    
-    pclose(fp);
+    return loc;
+}
+
+static void upload_mesh(const struct mesh *m, GLuint *vertex_buffer, GLuint *index_buffer)
+{
+    glGenBuffers(1, vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, *vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, m->vertices_size, m->vertices, GL_STATIC_DRAW);
+    glGenBuffers(1, index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *index_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m->indices_size, m->indices, GL_STATIC_DRAW);
+}
+
+/* 読み終わるまでは 1x1 の白 */
+static void create_placeholder_texture(struct torus_t *tw)
+{
+    static const unsigned char white[3] = { 255, 255, 255 };
     
-    GLuint tex;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    // glEnable(GL_SCISSOR_TEST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glGenTextures(1, &tw->tex);
+    glBindTexture(GL_TEXTURE_2D, tw->tex);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, white);
+}
+
+struct texture_asset {
+    struct asset asset;
+    struct torus_t *tw;
+    int flags;
+};
+
+static void load_texture(struct asset *a)
+{
+    struct texture_asset *ta = (struct texture_asset *) a;
+    a->failed = texture_load(&a->tex, a->name, ta->flags) < 0;
+}
+
+static void texture_ready(struct asset *a)
+{
+    struct texture_asset *ta = (struct texture_asset *) a;
+    
+    if (!a->failed) {
+	const struct texture *tex = &a->tex;
+	size_t size = 0;
+	for (int l = 0; l < tex->nr_levels; l++)
+	    size += tex->levels[l].size;
+	glDeleteTextures(1, &ta->tw->tex);
+	ta->tw->tex = a->texture;
+	printf("%s: %dx%d %s, %d levels, %zu bytes%s.\n", a->name,
+		tex->levels[0].width, tex->levels[0].height,
+		tex->format == GL_ETC1_RGB8_OES ? "ETC1" : tex->format == GL_RGBA ? "RGBA" : "RGB",
+		tex->nr_levels, size, tex->cached ? " from cache" : "");
+    }
+    texture_free(&a->tex);
+    free(ta);
+}
+
+/*
+ * LOD 一式。worker で作って、upload が済んだら GL thread で今のものと
+ * 差し替える。頂点と index は LOD を並べてひとつながりにしておく。
+ */
+struct torus_asset {
+    struct asset asset;
+    struct torus_t *tw;
+    int n, max_lods, index_size;
+    struct torus_lod lods[NR_LODS];
+    int nr_lods;
+    GLenum mode;
+    struct arena arena;
+};
+
+static void load_torus(struct asset *a)
+{
+    struct torus_asset *ta = (struct torus_asset *) a;
+    const struct torus_t *tw = ta->tw;
+    
+    ta->nr_lods = 0;
+    for (int n = ta->n; n >= LOD_MIN_N && ta->nr_lods < ta->max_lods; n /= 2)
+	ta->lods[ta->nr_lods++].n = n;
+    if (ta->nr_lods == 0)
+	ta->lods[ta->nr_lods++].n = ta->n;
+    
+    struct mesh meshes[NR_LODS];
+    size_t vertices_size = 0, indices_size = 0;
+    gint64 generate = 0, optimize = 0;
+    arena_init(&ta->arena, 1 << 20);
+    for (int l = 0; l < ta->nr_lods; l++) {
+	struct torus_lod *lod = &ta->lods[l];
+	struct mesh *m = &meshes[l];
+	
+	gint64 t0 = g_get_monotonic_time();
+	create_torus(m, &ta->arena, lod->n, tw->format, ta->index_size, tw->strip, sysconf(_SC_NPROCESSORS_ONLN));
+	gint64 t1 = g_get_monotonic_time();
+	
+	struct vcache_stats before = { 0, }, after = { 0, };
+	mesh_measure(m, &before, &ta->arena);
+	if (!tw->unoptimized && !tw->strip)
+	    mesh_optimize(m, &ta->arena);
+	mesh_measure(m, &after, &ta->arena);
+	gint64 t2 = g_get_monotonic_time();
+	
+	printf("%s lod %d: %ld triangles, %d vertices, %d indices in %d chunks, "
+		"ACMR %.3f -> %.3f, ATVR %.3f -> %.3f.\n",
+		a->name, l, before.triangles, m->nr_vertices, m->nr_indices, m->nr_chunks,
+		vcache_acmr(&before), vcache_acmr(&after), vcache_atvr(&before), vcache_atvr(&after));
+	lod->triangles = before.triangles;
+	vertices_size += m->vertices_size;
+	indices_size += m->indices_size;
+	generate += t1 - t0;
+	optimize += t2 - t1;
+    }
     
-    tw->tex = tex;
+    /* 全部の LOD をひとつの buffer に並べて、chunk の offset をずらす */
+    char *vertices = arena_alloc(&ta->arena, vertices_size);
+    char *indices = arena_alloc(&ta->arena, indices_size);
+    size_t vertex_offset = 0, index_offset = 0;
+    for (int l = 0; l < ta->nr_lods; l++) {
+	struct torus_lod *lod = &ta->lods[l];
+	struct mesh *m = &meshes[l];
+	
+	memcpy(vertices + vertex_offset, m->vertices, m->vertices_size);
+	memcpy(indices + index_offset, m->indices, m->indices_size);
+	lod->nr_chunks = m->nr_chunks;
+	lod->chunks = malloc(m->nr_chunks * sizeof *lod->chunks);
+	for (int c = 0; c < m->nr_chunks; c++) {
+	    lod->chunks[c] = m->chunks[c];
+	    lod->chunks[c].vertex_offset += vertex_offset;
+	    lod->chunks[c].index_offset += index_offset;
+	}
+	vertex_offset += m->vertices_size;
+	index_offset += m->indices_size;
+    }
+    a->buffers[0] = (struct asset_buffer) { GL_ARRAY_BUFFER, vertices, vertices_size, 0 };
+    a->buffers[1] = (struct asset_buffer) { GL_ELEMENT_ARRAY_BUFFER, indices, indices_size, 0 };
+    a->nr_buffers = 2;
+    ta->mode = meshes[0].mode;
+    
+    printf("%s: %d levels, %zu vertex bytes (%d each), %zu index bytes (%d-bit), "
+	    "generated in %.1f ms, reordered in %.1f ms.\n",
+	    a->name, ta->nr_lods, vertices_size, tw->format->stride, indices_size, ta->index_size * 8,
+	    generate / 1000.0, optimize / 1000.0);
+}
+
+static void torus_ready(struct asset *a)
+{
+    struct torus_asset *ta = (struct torus_asset *) a;
+    struct torus_t *tw = ta->tw;
+    
+    /* 最初は 0 なので delete は何もしない */
+    glDeleteBuffers(1, &tw->vertex_buffer);
+    glDeleteBuffers(1, &tw->index_buffer);
+    for (int l = 0; l < tw->nr_lods; l++)
+	free(tw->lods[l].chunks);
+    tw->vertex_buffer = a->buffers[0].name;
+    tw->index_buffer = a->buffers[1].name;
+    memcpy(tw->lods, ta->lods, sizeof tw->lods);
+    tw->nr_lods = ta->nr_lods;
+    tw->lod = 0;
+    tw->mode = ta->mode;
+    tw->index_type = ta->index_size == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+    
+    arena_free(&ta->arena);
+    free(ta);
+}
+
+static struct torus_asset *torus_asset(struct torus_t *tw, const char *name, int n, int max_lods, int index_size)
+{
+    struct torus_asset *ta = calloc(1, sizeof *ta);
+    ta->asset.name = name;
+    ta->asset.load = load_torus;
+    ta->asset.ready = torus_ready;
+    ta->tw = tw;
+    ta->n = n;
+    ta->max_lods = max_lods;
+    ta->index_size = index_size;
+    return ta;
 }
 
 static void create_torus_model(struct torus_t *tw)
 {
     tw->shader = create_shader_program(vertex_shader_source1, fragment_shader_source1);
     CHECK_GL_ERROR();
+    tw->loc_position = attrib_location(tw->shader, "position0");
+    tw->loc_normal = attrib_location(tw->shader, "normal0");
+    tw->loc_color = attrib_location(tw->shader, "color0");
+    tw->loc_tex = attrib_location(tw->shader, "tex0");
+    tw->attribs = 1 << tw->loc_position | 1 << tw->loc_normal | 1 << tw->loc_color | 1 << tw->loc_tex;
+    tw->loc_pvw = uniform_location(tw->shader, "matPVW");
+    tw->loc_rot = uniform_location(tw->shader, "matRot");
     
-    uint16_t indices_torus[TORUS_N * TORUS_N * 6];
-    struct vertex_t vertices_torus[TORUS_N * TORUS_N];
-    create_torus(indices_torus, vertices_torus);
-    glGenBuffers(1, &tw->vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, tw->vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof vertices_torus, vertices_torus, GL_STATIC_DRAW);
-    glGenBuffers(1, &tw->index_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tw->index_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof indices_torus, indices_torus, GL_STATIC_DRAW);
-    tw->nr_indices = TORUS_N * TORUS_N * 6;
-    CHECK_GL_ERROR();
-    
-    create_texture(tw);
+    /* sampler は unit 0 から変えないので最初に一度だけ */
+    glUseProgram(tw->shader);
+    glUniform1i(uniform_location(tw->shader, "texture"), 0);
+    CHECK_GL_ERROR();
+    
+    /* 32 bit index が使えなければ 65536 頂点ごとに分ける */
+    int index_size = 2;
+    if (!tw->short_indices && gl_has_extension("GL_OES_element_index_uint"))
+	index_size = 4;
+    
+    /* 一番粗い torus と白いテクスチャで描き始めて、本物は後から差し替える */
+    asset_load_now(&torus_asset(tw, "placeholder torus", LOD_MIN_N, 1, 2)->asset);
+    create_placeholder_texture(tw);
+    CHECK_GL_ERROR();
+    
+    assets_load(&torus_asset(tw, "torus", tw->n, tw->no_lod ? 1 : NR_LODS, index_size)->asset);
+    struct texture_asset *ta = calloc(1, sizeof *ta);
+    ta->asset.name = tw->texture_path;
+    ta->asset.load = load_texture;
+    ta->asset.ready = texture_ready;
+    ta->tw = tw;
+    if (tw->etc1) {
+	if (gl_has_extension("GL_OES_compressed_ETC1_RGB8_texture"))
+	    ta->flags |= TEXTURE_ETC1;
+	else
+	    fprintf(stderr, "GL_OES_compressed_ETC1_RGB8_texture not supported, keeping the texture uncompressed.\n");
+    }
+    assets_load(&ta->asset);
 }
 
 static void create_background_model(struct background_t *bw)
 {
     bw->shader = create_shader_program(vertex_shader_source2, fragment_shader_source2);
     CHECK_GL_ERROR();
+    bw->loc_position = attrib_location(bw->shader, "position2");
+    bw->loc_color = attrib_location(bw->shader, "color2");
+    bw->attribs = 1 << bw->loc_position | 1 << bw->loc_color;
     
-    uint16_t indices[24];
-    struct vertex_t vertices[16];
-    create_flat(indices, vertices);
-    glGenBuffers(1, &bw->vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, bw->vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices, GL_STATIC_DRAW);
-    glGenBuffers(1, &bw->index_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bw->index_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof indices, indices, GL_STATIC_DRAW);
-    bw->nr_indices = 24;
+    struct arena arena;
+    struct mesh m;
+    arena_init(&arena, 4096);
+    create_flat(&m, &arena);
+    upload_mesh(&m, &bw->vertex_buffer, &bw->index_buffer);
+    bw->nr_indices = m.nr_indices;
+    arena_free(&arena);
     CHECK_GL_ERROR();
 }
 
@@ -396,122 +447,86 @@ static void create_resources(struct work_t *w)
     create_background_model(&w->bg);
 }
 
-static void draw_background(struct background_t *bw)
+static void draw_background(struct gl_state *gl, struct background_t *bw)
 {
     CHECK_GL_ERROR();
-    glEnable(GL_DEPTH_TEST);
+    gl_state_enable(gl, GL_DEPTH_TEST, 1);
     CHECK_GL_ERROR();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     CHECK_GL_ERROR();
     
     int stride = sizeof(struct vertex_t);
     
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_CULL_FACE);
+    gl_state_enable(gl, GL_CULL_FACE, 0);
     
-    glUseProgram(bw->shader);
+    gl_state_use_program(gl, bw->shader);
     CHECK_GL_ERROR();
     
-    glBindBuffer(GL_ARRAY_BUFFER, bw->vertex_buffer);
+    gl_state_bind_buffer(gl, GL_ARRAY_BUFFER, bw->vertex_buffer);
     CHECK_GL_ERROR();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bw->index_buffer);
+    gl_state_bind_buffer(gl, GL_ELEMENT_ARRAY_BUFFER, bw->index_buffer);
     CHECK_GL_ERROR();
     
-    GLint locPos = glGetAttribLocation(bw->shader, "position2");
-    GLint locCol = glGetAttribLocation(bw->shader, "color2");
-    
-    CHECK_GL_ERROR();
-    glVertexAttribPointer(locPos, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->position);
+    glVertexAttribPointer(bw->loc_position, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->position);
     CHECK_GL_ERROR();
-    glVertexAttribPointer(locCol, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->color);
+    glVertexAttribPointer(bw->loc_color, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->color);
     CHECK_GL_ERROR();
-    glEnableVertexAttribArray(locPos);
-    glEnableVertexAttribArray(locCol);
+    gl_state_attribs(gl, bw->attribs);
     CHECK_GL_ERROR();
     
     glDrawElements(GL_TRIANGLES, bw->nr_indices, GL_UNSIGNED_SHORT, NULL);
 }
 
-static void draw_torus(struct torus_t *tw, int width, int height)
+static void attrib_pointer(GLint loc, const struct attrib_format *a, int stride, size_t base)
+{
+    glVertexAttribPointer(loc, a->size, a->type, a->normalized, stride, (void *) (base + a->offset));
+}
+
+static void select_lod(struct torus_t *tw, float radius_px)
+{
+    float want = 2 * M_PI * radius_px / LOD_SEGMENT_PX;
+    int lod = tw->lod;
+    
+    while (lod > 0 && tw->lods[lod].n < want)
+	lod--;
+    while (lod + 1 < tw->nr_lods && tw->lods[lod + 1].n * LOD_HYSTERESIS >= want)
+	lod++;
+    tw->lod = lod;
+    tw->lods[lod].frames++;
+}
+
+static void draw_torus(struct gl_state *gl, struct torus_t *tw, int width, int height)
 {
     glClear(GL_DEPTH_BUFFER_BIT);
     
     if ((tw->angle += 0.01) >= 12 * M_PI)
 	tw->angle -= 12 * M_PI;
     
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_CULL_FACE);
+    gl_state_enable(gl, GL_CULL_FACE, 1);
     glCullFace(GL_BACK);
     CHECK_GL_ERROR();
-    glUseProgram(tw->shader);
+    gl_state_use_program(gl, tw->shader);
     CHECK_GL_ERROR();
     
-    glBindBuffer(GL_ARRAY_BUFFER, tw->vertex_buffer);
+    gl_state_bind_buffer(gl, GL_ARRAY_BUFFER, tw->vertex_buffer);
     CHECK_GL_ERROR();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tw->index_buffer);
+    gl_state_bind_buffer(gl, GL_ELEMENT_ARRAY_BUFFER, tw->index_buffer);
     CHECK_GL_ERROR();
     
-    GLint locPos = glGetAttribLocation(tw->shader, "position0");
-    GLint locNrm = glGetAttribLocation(tw->shader, "normal0");
-    GLint locCol = glGetAttribLocation(tw->shader, "color0");
-    GLint locTex = glGetAttribLocation(tw->shader, "tex0");
-    
-    int stride = sizeof(struct vertex_t);
-    glVertexAttribPointer(locPos, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->position);
-    CHECK_GL_ERROR();
-    glVertexAttribPointer(locNrm, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->normal);
-    CHECK_GL_ERROR();
-    glVertexAttribPointer(locCol, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->color);
-    CHECK_GL_ERROR();
-    glVertexAttribPointer(locTex, 3, GL_FLOAT, GL_FALSE, stride, &((struct vertex_t *) NULL)->texture);
-    CHECK_GL_ERROR();
-    glEnableVertexAttribArray(locPos);
-    glEnableVertexAttribArray(locNrm);
-    glEnableVertexAttribArray(locCol);
-    glEnableVertexAttribArray(locTex);
+    gl_state_attribs(gl, tw->attribs);
     CHECK_GL_ERROR();
     
-    struct mat4 r1 = {
-	{
-	    { cos(tw->angle), -sin(tw->angle), 0, 0 },
-	    { sin(tw->angle),  cos(tw->angle), 0, 0 },
-	    { 0,                    0, 1, 0 },
-	    { 0,                    0, 0, 1 },
-	},
-    };
-    struct mat4 r2 = {
-	{
-	    { 1,            0,             0, 0 },
-	    { 0, cos(tw->angle/2), -sin(tw->angle/2), 0 },
-	    { 0, sin(tw->angle/2),  cos(tw->angle/2), 0 },
-	    { 0,            0,             0, 1 },
-	},
-    };
-    struct mat4 r3 = {
-	{
-	    {  cos(tw->angle/3), 0, sin(tw->angle/3), 0 },
-	    {             0, 1,            0, 0 },
-	    { -sin(tw->angle/3), 0, cos(tw->angle/3), 0 },
-	    {             0, 0,            0, 1 },
-	},
-    };
-    const float scale = 1.0;
-    struct mat4 s1 = {
-	{
-	    { scale,     0,     0, 0 },
-	    {     0, scale,     0, 0 },
-	    {     0,     0, scale, 0 },
-	    {     0,     0,     0, 1 },
-	},
-    };
-    struct mat4 t1 = {
-	{
-	    { 1, 0, 0, 0 },
-	    { 0, 1, 0, 0 },
-	    { 0, 0, 1, -100 },
-	    { 0, 0, 0, 1 },
-	},
-    };
+    /* 角度ごとに cos と sin は一度だけ */
+    float a1 = tw->angle, a2 = tw->angle / 2, a3 = tw->angle / 3;
+    struct mat4 r1, r2, r3, s1, t1, proj, m, rot;
+    mat4_rotate_z(&r1, cosf(a1), sinf(a1));
+    mat4_rotate_x(&r2, cosf(a2), sinf(a2));
+    mat4_rotate_y(&r3, cosf(a3), sinf(a3));
+    /* packed_format の position はここで元の大きさに戻る */
+    const float scale = tw->format->position_scale;
+    mat4_scale(&s1, scale, scale, scale);
+    mat4_translate(&t1, 0, 0, -100);
+    
     const float near = 80;
     const float far = 120;
     float right = 10;
@@ -521,56 +536,71 @@ static void draw_torus(struct torus_t *tw, int width, int height)
     } else {
 	top *= (float) height / width;
     }
-    struct mat4 proj = {
-	{
-	    { near/right, 0, 0, 0 },
-	    { 0, near/top, 0, 0 },
-	    { 0, 0, -(far+near)/(far-near), -2*far*near/(far-near) },
-	    { 0, 0, -1, 0 },
-	},
-    };
-    struct mat4 m = {
-	{
-	    { 1, 0, 0, 0 },
-	    { 0, 1, 0, 0 },
-	    { 0, 0, 1, 0 },
-	    { 0, 0, 0, 1 },
-	},
-    };
-    m = mat4_mul(r1, m);
-    m = mat4_mul(r2, m);
-    m = mat4_mul(r3, m);
-    m = mat4_mul(s1, m);
-    struct mat4 rot = m;
-    m = mat4_mul(t1, m);
-    m = mat4_mul(proj, m);
-    
-    GLint locPVW = glGetUniformLocation(tw->shader, "matPVW");
-    GLint locRot = glGetUniformLocation(tw->shader, "matRot");
-    GLint locTexture = glGetUniformLocation(tw->shader, "texture");
+    mat4_frustum(&proj, right, top, near, far);
+    
+    mat4_ops->mul(&m, &r2, &r1);
+    mat4_ops->mul(&m, &r3, &m);
+    mat4_ops->mul(&rot, &s1, &m);
+    mat4_ops->mul(&m, &t1, &rot);
+    mat4_ops->mul(&m, &proj, &m);
     
     CHECK_GL_ERROR();
-    glUniformMatrix4fv(locPVW, 1, GL_TRUE, (float *) &m);
-    CHECK_GL_ERROR();
-    glUniformMatrix4fv(locRot, 1, GL_TRUE, (float *) &rot);
+    glUniformMatrix4fv(tw->loc_pvw, 1, GL_FALSE, m.m);
     CHECK_GL_ERROR();
-    glUniform1i(locTexture, 0);
+    glUniformMatrix4fv(tw->loc_rot, 1, GL_FALSE, rot.m);
     CHECK_GL_ERROR();
-    glBindTexture(GL_TEXTURE_2D, tw->tex);
+    gl_state_bind_texture(gl, tw->tex);
     CHECK_GL_ERROR();
     
-    glBindBuffer(GL_ARRAY_BUFFER, tw->vertex_buffer);
-    CHECK_GL_ERROR();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tw->index_buffer);
-    CHECK_GL_ERROR();
+    /* 画面上の外接球の半径。t1 で奥に動かした分だけ小さくなる */
+    select_lod(tw, (RADIUS + MINOR_RADIUS) * M(&proj, 1, 1) / -M(&t1, 2, 3) * height / 2);
+    const struct torus_lod *lod = &tw->lods[tw->lod];
     
-    glDrawElements(GL_TRIANGLES, tw->nr_indices, GL_UNSIGNED_SHORT, NULL);
+    /* chunk ごとに attrib の先頭をずらす */
+    const struct vertex_format *f = tw->format;
+    for (int i = 0; i < lod->nr_chunks; i++) {
+	const struct mesh_chunk *chunk = &lod->chunks[i];
+	attrib_pointer(tw->loc_position, &f->position, f->stride, chunk->vertex_offset);
+	attrib_pointer(tw->loc_normal, &f->normal, f->stride, chunk->vertex_offset);
+	attrib_pointer(tw->loc_color, &f->color, f->stride, chunk->vertex_offset);
+	attrib_pointer(tw->loc_tex, &f->texture, f->stride, chunk->vertex_offset);
+	CHECK_GL_ERROR();
+	glDrawElements(tw->mode, chunk->nr_indices, tw->index_type, (void *) chunk->index_offset);
+    }
 }
 
 static void draw(struct work_t *w, int width, int height)
 {
-    draw_background(&w->bg);
-    draw_torus(&w->torus, width, height);
+    draw_background(&w->gl, &w->bg);
+    draw_torus(&w->gl, &w->torus, width, height);
+}
+
+static void report_stats(struct work_t *w)
+{
+    w->frames++;
+    w->issued += w->gl.issued;
+    w->skipped += w->gl.skipped;
+    
+    gint64 now = g_get_monotonic_time();
+    if (now - w->report_time < 5000000)
+	return;
+    if (w->report_time != 0) {
+	printf("gl state: %.1f calls, %.1f skipped per frame.\n",
+		(double) w->issued / w->frames, (double) w->skipped / w->frames);
+	
+	struct torus_t *tw = &w->torus;
+	long triangles = 0;
+	printf("torus lod frames:");
+	for (int l = 0; l < tw->nr_lods; l++) {
+	    printf(" %d (%ld tris) x %u", tw->lods[l].n, tw->lods[l].triangles, tw->lods[l].frames);
+	    triangles += tw->lods[l].triangles * tw->lods[l].frames;
+	}
+	printf(", %.0f triangles per frame.\n", (double) triangles / w->frames);
+    }
+    for (int l = 0; l < w->torus.nr_lods; l++)
+	w->torus.lods[l].frames = 0;
+    w->report_time = now;
+    w->frames = w->issued = w->skipped = 0;
 }
 
 static gboolean render(GtkWidget *area, GdkGLContext *context, gpointer user_data)
@@ -578,19 +608,33 @@ static gboolean render(GtkWidget *area, GdkGLContext *context, gpointer user_dat
     struct work_t *w = user_data;
     CHECK_GL_ERROR();
     if (!w->inited) {
+	gl_debug_init();
+	program_cache_init();
 	create_resources(w);
 	CHECK_GL_ERROR();
 	w->inited = 1;
     }
     
+    /* 読み終わった asset を frame あたり upload_budget byte まで */
+    assets_upload(w->upload_budget);
+    CHECK_GL_ERROR();
+    
     glClearColor(0, 0, 0, 1);
     CHECK_GL_ERROR();
     
+    /* 前の frame から後に GTK が触った状態は分からない */
+    gl_state_invalidate(&w->gl);
     draw(w, gdk_window_get_width(gtk_widget_get_window(area)),
-	    gdk_window_get_height(gtk_widget_get_window(area)));
+		    gdk_window_get_height(gtk_widget_get_window(area)));
     
     CHECK_GL_ERROR();
-    
+    if (w->start != 0) {
+	printf("first frame %.1f ms after start, %d assets still loading.\n",
+		(assets_clock() - w->start) / 1e6, assets_pending());
+	w->start = 0;
+    }
+    report_stats(w);
+
     return TRUE;
 }
 
@@ -600,12 +644,87 @@ static gboolean timeout_cb(gpointer user_data)
     return G_SOURCE_CONTINUE;
 }
 
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-BEFLStu] [-i texture] [-n segments] [-U KiB]\n", argv0);
+    fprintf(stderr, "  -B  check the matrix kernels against the scalar ones, time them and exit\n");
+    fprintf(stderr, "  -E  compress the texture to ETC1 if the driver supports it\n");
+    fprintf(stderr, "  -F  send the torus as 44-byte float vertices instead of 24-byte packed ones\n");
+    fprintf(stderr, "  -L  always draw the full tessellation instead of picking a level of detail\n");
+    fprintf(stderr, "  -S  use 16-bit indices split into chunks even if 32-bit ones are supported\n");
+    fprintf(stderr, "  -t  draw the torus as triangle strips, one per chunk\n");
+    fprintf(stderr, "  -u  keep the generated row order instead of reordering for the vertex cache\n");
+    fprintf(stderr, "  -i  PNG or binary PPM file for the torus, mipmapped and cached (default test.png)\n");
+    fprintf(stderr, "  -n  segments around each circle of the torus (default %d, 2n^2 triangles)\n", TORUS_N);
+    fprintf(stderr, "  -U  bytes uploaded to GL per frame while assets load, in KiB (default 1024)\n");
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv)
 {
     struct work_t w;
     memset(&w, 0, sizeof w);
+    w.start = assets_clock();
+    
+    /* -B は display 無しでも動くように */
+    gboolean have_display = gtk_init_check(&argc, &argv);
+    
+    w.torus.format = &packed_format;
+    w.torus.n = TORUS_N;
+    w.torus.texture_path = "test.png";
+    w.upload_budget = 1024 << 10;
+    int c, bench = 0;
+    while ((c = getopt(argc, argv, "BEFLStui:n:U:")) != -1) {
+	switch (c) {
+	case 'B':
+	    bench = 1;
+	    break;
+	case 'E':
+	    w.torus.etc1 = 1;
+	    break;
+	case 'F':
+	    w.torus.format = &float_format;
+	    break;
+	case 'L':
+	    w.torus.no_lod = 1;
+	    break;
+	case 'S':
+	    w.torus.short_indices = 1;
+	    break;
+	case 't':
+	    w.torus.strip = 1;
+	    break;
+	case 'u':
+	    w.torus.unoptimized = 1;
+	    break;
+	case 'i':
+	    w.torus.texture_path = optarg;
+	    break;
+	case 'n':
+	    if ((w.torus.n = atoi(optarg)) < 3 || w.torus.n > 32768)
+		usage(argv[0]);
+	    break;
+	case 'U':
+	    if (atoi(optarg) <= 0)
+		usage(argv[0]);
+	    w.upload_budget = (size_t) atoi(optarg) << 10;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
     
-    gtk_init(&argc, &argv);
+    mat4_init();
+    if (bench) {
+	if (mat4_self_test() != 0)
+	    return 1;
+	mat4_bench();
+	return 0;
+    }
+    if (!have_display) {
+	fprintf(stderr, "cannot open display.\n");
+	return 1;
+    }
     
     GtkWidget *toplevel = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_widget_show(toplevel);
@@ -623,6 +742,9 @@ int main(int argc, char **argv)
     
     g_timeout_add(17, timeout_cb, drawable);
     
+    /* mesh の生成は中でさらに分けるので、読み込み自体は 2 本で足りる */
+    assets_start(2);
+    
     gtk_main();
     
     return 0;
@@ -0,0 +1,277 @@
+/*
+ * 行列の掛け算と点の変換。起動時に cpuid を見て実装を選ぶ。
+ * どの実装も列 0 から順に足すので、FMA を使わない限り結果は一致する。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "mat4.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+const struct mat4_kernels *mat4_ops;
+
+static void mul_c(struct mat4 *d, const struct mat4 *a, const struct mat4 *b)
+{
+    struct mat4 t;
+    
+    for (int col = 0; col < 4; col++) {
+	for (int row = 0; row < 4; row++) {
+	    float sum = M(a, row, 0) * M(b, 0, col);
+	    for (int i = 1; i < 4; i++)
+		sum += M(a, row, i) * M(b, i, col);
+	    M(&t, row, col) = sum;
+	}
+    }
+    *d = t;
+}
+
+static void transform_c(struct vec4 *dst, const struct mat4 *m, const struct vec4 *src, int count)
+{
+    for (int i = 0; i < count; i++) {
+	struct vec4 s = src[i];
+	for (int row = 0; row < 4; row++) {
+	    float sum = M(m, row, 0) * s.v[0];
+	    for (int k = 1; k < 4; k++)
+		sum += M(m, row, k) * s.v[k];
+	    dst[i].v[row] = sum;
+	}
+    }
+}
+
+static const struct mat4_kernels kernels_c = {
+    "c", mul_c, transform_c,
+};
+
+#ifdef HAVE_X86
+
+/* 結果の列 j は a の列の b(i, j) 倍の和 */
+__attribute__((target("sse")))
+static void mul_sse(struct mat4 *d, const struct mat4 *a, const struct mat4 *b)
+{
+    __m128 a0 = _mm_load_ps(&a->m[0]);
+    __m128 a1 = _mm_load_ps(&a->m[4]);
+    __m128 a2 = _mm_load_ps(&a->m[8]);
+    __m128 a3 = _mm_load_ps(&a->m[12]);
+    __m128 col[4];
+    
+    for (int j = 0; j < 4; j++) {
+	__m128 bj = _mm_load_ps(&b->m[j * 4]);
+	__m128 sum = _mm_mul_ps(a0, _mm_shuffle_ps(bj, bj, 0x00));
+	sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_shuffle_ps(bj, bj, 0x55)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_shuffle_ps(bj, bj, 0xaa)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_shuffle_ps(bj, bj, 0xff)));
+	col[j] = sum;
+    }
+    for (int j = 0; j < 4; j++)
+	_mm_store_ps(&d->m[j * 4], col[j]);
+}
+
+__attribute__((target("sse")))
+static void transform_sse(struct vec4 *dst, const struct mat4 *m, const struct vec4 *src, int count)
+{
+    __m128 m0 = _mm_load_ps(&m->m[0]);
+    __m128 m1 = _mm_load_ps(&m->m[4]);
+    __m128 m2 = _mm_load_ps(&m->m[8]);
+    __m128 m3 = _mm_load_ps(&m->m[12]);
+    
+    for (int i = 0; i < count; i++) {
+	__m128 s = _mm_load_ps(src[i].v);
+	__m128 sum = _mm_mul_ps(m0, _mm_shuffle_ps(s, s, 0x00));
+	sum = _mm_add_ps(sum, _mm_mul_ps(m1, _mm_shuffle_ps(s, s, 0x55)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(m2, _mm_shuffle_ps(s, s, 0xaa)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(m3, _mm_shuffle_ps(s, s, 0xff)));
+	_mm_store_ps(dst[i].v, sum);
+    }
+}
+
+static const struct mat4_kernels kernels_sse = {
+    "sse", mul_sse, transform_sse,
+};
+
+/* 256 bit に 2 列 (2 点) ずつ。lane の中で broadcast する。 */
+__attribute__((target("avx")))
+static void mul_avx(struct mat4 *d, const struct mat4 *a, const struct mat4 *b)
+{
+    __m256 a0 = _mm256_broadcast_ps((const __m128 *) &a->m[0]);
+    __m256 a1 = _mm256_broadcast_ps((const __m128 *) &a->m[4]);
+    __m256 a2 = _mm256_broadcast_ps((const __m128 *) &a->m[8]);
+    __m256 a3 = _mm256_broadcast_ps((const __m128 *) &a->m[12]);
+    __m256 b01 = _mm256_load_ps(&b->m[0]);
+    __m256 b23 = _mm256_load_ps(&b->m[8]);
+    
+    __m256 c01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+    c01 = _mm256_add_ps(c01, _mm256_mul_ps(a1, _mm256_permute_ps(b01, 0x55)));
+    c01 = _mm256_add_ps(c01, _mm256_mul_ps(a2, _mm256_permute_ps(b01, 0xaa)));
+    c01 = _mm256_add_ps(c01, _mm256_mul_ps(a3, _mm256_permute_ps(b01, 0xff)));
+    __m256 c23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+    c23 = _mm256_add_ps(c23, _mm256_mul_ps(a1, _mm256_permute_ps(b23, 0x55)));
+    c23 = _mm256_add_ps(c23, _mm256_mul_ps(a2, _mm256_permute_ps(b23, 0xaa)));
+    c23 = _mm256_add_ps(c23, _mm256_mul_ps(a3, _mm256_permute_ps(b23, 0xff)));
+    _mm256_store_ps(&d->m[0], c01);
+    _mm256_store_ps(&d->m[8], c23);
+}
+
+__attribute__((target("avx")))
+static void transform_avx(struct vec4 *dst, const struct mat4 *m, const struct vec4 *src, int count)
+{
+    __m256 m0 = _mm256_broadcast_ps((const __m128 *) &m->m[0]);
+    __m256 m1 = _mm256_broadcast_ps((const __m128 *) &m->m[4]);
+    __m256 m2 = _mm256_broadcast_ps((const __m128 *) &m->m[8]);
+    __m256 m3 = _mm256_broadcast_ps((const __m128 *) &m->m[12]);
+    int i = 0;
+    
+    for (; i + 2 <= count; i += 2) {
+	__m256 s = _mm256_loadu_ps(src[i].v);
+	__m256 sum = _mm256_mul_ps(m0, _mm256_permute_ps(s, 0x00));
+	sum = _mm256_add_ps(sum, _mm256_mul_ps(m1, _mm256_permute_ps(s, 0x55)));
+	sum = _mm256_add_ps(sum, _mm256_mul_ps(m2, _mm256_permute_ps(s, 0xaa)));
+	sum = _mm256_add_ps(sum, _mm256_mul_ps(m3, _mm256_permute_ps(s, 0xff)));
+	_mm256_storeu_ps(dst[i].v, sum);
+    }
+    transform_sse(dst + i, m, src + i, count - i);
+}
+
+static const struct mat4_kernels kernels_avx = {
+    "avx", mul_avx, transform_avx,
+};
+
+#endif
+
+static int available_kernels(const struct mat4_kernels **list)
+{
+    int n = 0;
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+	list[n++] = &kernels_avx;
+    if (__builtin_cpu_supports("sse"))
+	list[n++] = &kernels_sse;
+#endif
+    list[n++] = &kernels_c;
+    return n;
+}
+
+void mat4_init(void)
+{
+    const struct mat4_kernels *list[3];
+    int n = available_kernels(list);
+    const char *want = getenv("GTKTEST_MAT4");
+    
+    mat4_ops = list[0];
+    if (want) {
+	for (int i = 0; i < n; i++) {
+	    if (strcmp(list[i]->name, want) == 0)
+		mat4_ops = list[i];
+	}
+    }
+    fprintf(stderr, "mat4 kernels: %s.\n", mat4_ops->name);
+}
+
+static int compare(const char *kname, const char *what, const float *ref, const float *got, int count)
+{
+    for (int i = 0; i < count; i++) {
+	if (fabsf(ref[i] - got[i]) > 1e-5f * (1 + fabsf(ref[i]))) {
+	    fprintf(stderr, "%s: %s: [%d] %g != %g.\n", kname, what, i, got[i], ref[i]);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+#define NR_POINTS 1001
+
+static void random_fill(float *f, int count)
+{
+    for (int i = 0; i < count; i++)
+	f[i] = (float) rand() / RAND_MAX * 20 - 10;
+}
+
+/* 全実装を scalar と突き合わせる。不一致の数を返す。 */
+int mat4_self_test(void)
+{
+    const struct mat4_kernels *list[3];
+    int n = available_kernels(list);
+    static struct vec4 src[NR_POINTS], ref[NR_POINTS], got[NR_POINTS];
+    struct mat4 a, b, d_ref, d_got;
+    int failed = 0;
+    
+    srand(1);
+    random_fill(a.m, 16);
+    random_fill(b.m, 16);
+    random_fill(src[0].v, NR_POINTS * 4);
+    kernels_c.mul(&d_ref, &a, &b);
+    
+    for (int k = 0; k < n; k++) {
+	const struct mat4_kernels *kn = list[k];
+	int before = failed;
+	
+	kn->mul(&d_got, &a, &b);
+	failed += compare(kn->name, "mul", d_ref.m, d_got.m, 16);
+	/* d が a と同じとき */
+	d_got = a;
+	kn->mul(&d_got, &d_got, &b);
+	failed += compare(kn->name, "mul in place", d_ref.m, d_got.m, 16);
+	
+	for (int count = 0; count <= NR_POINTS; count = count < 10 ? count + 1 : count * 2 + 1) {
+	    int c = count < NR_POINTS ? count : NR_POINTS;
+	    memset(got, 0, sizeof got);
+	    memset(ref, 0, sizeof ref);
+	    kernels_c.transform(ref, &a, src, c);
+	    kn->transform(got, &a, src, c);
+	    failed += compare(kn->name, "transform", ref[0].v, got[0].v, NR_POINTS * 4);
+	}
+	fprintf(stderr, "%s: %s.\n", kn->name, failed != before ? "FAILED" : "ok");
+    }
+    return failed;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* 結果を使っておかないと消される */
+static volatile float sink;
+
+/* mul は draw_torus と同じように前の結果に掛けていく */
+void mat4_bench(void)
+{
+    const struct mat4_kernels *list[3];
+    int n = available_kernels(list);
+    enum { MULS = 10000000, POINTS = 1 << 16, ROUNDS = 200 };
+    struct vec4 *src = aligned_alloc(32, POINTS * sizeof *src);
+    struct vec4 *dst = aligned_alloc(32, POINTS * sizeof *dst);
+    struct mat4 a, b;
+    
+    srand(1);
+    random_fill(src[0].v, POINTS * 4);
+    
+    printf("%-6s %12s %16s\n", "", "mul ns", "transform ns/pt");
+    for (int k = 0; k < n; k++) {
+	const struct mat4_kernels *kn = list[k];
+	
+	mat4_rotate_z(&b, cosf(0.001f), sinf(0.001f));
+	mat4_identity(&a);
+	double t0 = now();
+	for (int i = 0; i < MULS; i++)
+	    kn->mul(&a, &b, &a);
+	double t1 = now();
+	for (int i = 0; i < ROUNDS; i++)
+	    kn->transform(dst, &a, src, POINTS);
+	double t2 = now();
+	
+	sink = a.m[0] + dst[POINTS - 1].v[0];
+	printf("%-6s %12.2f %16.3f\n", kn->name, (t1 - t0) * 1e9 / MULS,
+		(t2 - t1) * 1e9 / ((double) POINTS * ROUNDS));
+    }
+    free(src);
+    free(dst);
+}
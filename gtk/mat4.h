@@ -0,0 +1,94 @@
+#ifndef MAT4_H
+#define MAT4_H
+
+/*
+ * column-major の 4x4 行列。GL にそのまま GL_FALSE で渡せる。
+ * M(m, row, col) で行と列を指定して触る。
+ */
+struct mat4 {
+    float m[16];
+} __attribute__((aligned(32)));
+
+struct vec4 {
+    float v[4];
+} __attribute__((aligned(16)));
+
+#define M(mat, row, col) ((mat)->m[(col) * 4 + (row)])
+
+struct mat4_kernels {
+    const char *name;
+    /* d = a * b。d は a や b と同じでもよい。 */
+    void (*mul)(struct mat4 *d, const struct mat4 *a, const struct mat4 *b);
+    /* dst[i] = m * src[i] */
+    void (*transform)(struct vec4 *dst, const struct mat4 *m, const struct vec4 *src, int count);
+};
+
+extern const struct mat4_kernels *mat4_ops;
+
+void mat4_init(void);
+int mat4_self_test(void);
+void mat4_bench(void);
+
+static inline void mat4_identity(struct mat4 *d)
+{
+    for (int i = 0; i < 16; i++)
+	d->m[i] = i % 5 == 0;
+}
+
+static inline void mat4_translate(struct mat4 *d, float x, float y, float z)
+{
+    mat4_identity(d);
+    M(d, 0, 3) = x;
+    M(d, 1, 3) = y;
+    M(d, 2, 3) = z;
+}
+
+static inline void mat4_scale(struct mat4 *d, float x, float y, float z)
+{
+    mat4_identity(d);
+    M(d, 0, 0) = x;
+    M(d, 1, 1) = y;
+    M(d, 2, 2) = z;
+}
+
+/* 回転は cos, sin を渡す。同じ角度の三角関数を何度も計算しないように。 */
+static inline void mat4_rotate_x(struct mat4 *d, float c, float s)
+{
+    mat4_identity(d);
+    M(d, 1, 1) = c;
+    M(d, 1, 2) = -s;
+    M(d, 2, 1) = s;
+    M(d, 2, 2) = c;
+}
+
+static inline void mat4_rotate_y(struct mat4 *d, float c, float s)
+{
+    mat4_identity(d);
+    M(d, 0, 0) = c;
+    M(d, 0, 2) = s;
+    M(d, 2, 0) = -s;
+    M(d, 2, 2) = c;
+}
+
+static inline void mat4_rotate_z(struct mat4 *d, float c, float s)
+{
+    mat4_identity(d);
+    M(d, 0, 0) = c;
+    M(d, 0, 1) = -s;
+    M(d, 1, 0) = s;
+    M(d, 1, 1) = c;
+}
+
+/* 左右上下対称の glFrustum */
+static inline void mat4_frustum(struct mat4 *d, float right, float top, float near, float far)
+{
+    for (int i = 0; i < 16; i++)
+	d->m[i] = 0;
+    M(d, 0, 0) = near / right;
+    M(d, 1, 1) = near / top;
+    M(d, 2, 2) = -(far + near) / (far - near);
+    M(d, 2, 3) = -2 * far * near / (far - near);
+    M(d, 3, 2) = -1;
+}
+
+#endif
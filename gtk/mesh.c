@@ -0,0 +1,307 @@
+/*
+ * torus と背景の頂点と index を作る。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "mesh.h"
+
+const struct vertex_format float_format = {
+    sizeof(struct vertex_t), 1.0f,
+    { 3, GL_FLOAT, GL_FALSE, offsetof(struct vertex_t, position) },
+    { 3, GL_FLOAT, GL_FALSE, offsetof(struct vertex_t, normal) },
+    { 2, GL_FLOAT, GL_FALSE, offsetof(struct vertex_t, texture) },
+    { 3, GL_FLOAT, GL_FALSE, offsetof(struct vertex_t, color) },
+};
+
+const struct vertex_format packed_format = {
+    sizeof(struct packed_vertex_t), RADIUS + MINOR_RADIUS,
+    { 3, GL_SHORT, GL_TRUE, offsetof(struct packed_vertex_t, position) },
+    { 3, GL_SHORT, GL_TRUE, offsetof(struct packed_vertex_t, normal) },
+    { 2, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(struct packed_vertex_t, texture) },
+    { 3, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(struct packed_vertex_t, color) },
+};
+
+/*
+ * GLES2 は正規化する GL_SHORT の c を (2c + 1) / 65535 に戻すので、
+ * それに合わせて作る。ずれは 1/65535 以下で、0 もちょうどには戻らない。
+ * c / 32767 で戻す GLES3 の driver では -1 に近いほどずれ、最大 1.5/32767。
+ */
+static int16_t snorm16(float f)
+{
+    f = f < -1 ? -1 : f > 1 ? 1 : f;
+    return lrintf((f * 65535 - 1) / 2);
+}
+
+static uint16_t unorm16(float f)
+{
+    f = f < 0 ? 0 : f > 1 ? 1 : f;
+    return lrintf(f * 65535);
+}
+
+static uint8_t unorm8(float f)
+{
+    f = f < 0 ? 0 : f > 1 ? 1 : f;
+    return lrintf(f * 255);
+}
+
+static void pack_vertex(struct packed_vertex_t *dst, const struct vertex_t *v, float scale)
+{
+    *dst = (struct packed_vertex_t) {
+	.position = { snorm16(v->position.x / scale), snorm16(v->position.y / scale), snorm16(v->position.z / scale) },
+	.normal = { snorm16(v->normal.nx), snorm16(v->normal.ny), snorm16(v->normal.nz) },
+	.texture = { unorm16(v->texture.u), unorm16(v->texture.v) },
+	.color = { unorm8(v->color.r), unorm8(v->color.g), unorm8(v->color.b), 255 },
+    };
+}
+
+/*
+ * chunk の中の行の範囲が 1 job。
+ * chunk は quad の行 first_row 〜 first_row + nr_quad_rows - 1 を持ち、
+ * 頂点の行は nr_rows 行 (最後の行は次の chunk の先頭と同じもの)。
+ * 1 chunk で全部持つときは nr_rows == n で、最後の quad は 0 行目に戻る。
+ */
+struct torus_job {
+    const struct mesh *m;
+    const struct mesh_chunk *chunk;
+    int n;
+    int first_row, nr_rows, nr_quad_rows;
+    int k0, k1;
+};
+
+struct torus_work {
+    struct torus_job *jobs;
+    int nr_jobs;
+    int next;
+};
+
+static void put_index(const struct mesh *m, void *indices, size_t i, uint32_t v)
+{
+    if (m->index_size == 4)
+	((uint32_t *) indices)[i] = v;
+    else
+	((uint16_t *) indices)[i] = v;
+}
+
+/*
+ * (k, j), (k + 1, j) を j = 0..n と並べると、偶数番目が (i0, i2, i1)、
+ * 奇数番目が (i1, i2, i3) になってリストと同じ向きになる。行は (k + 1, 0) で
+ * 終わって次の行は同じ頂点から始まるので、そのままつなげば間は縮退三角形
+ * 2 つになる。1 行は偶数個なので向きも変わらない。
+ */
+#define STRIP_ROW(n) (2 * ((n) + 1))
+
+static void torus_strip_row(const struct torus_job *job, void *indices, int k)
+{
+    const struct mesh *m = job->m;
+    int n = job->n;
+    uint32_t next = (k + 1) % job->nr_rows * n;
+    size_t idx = (size_t) k * STRIP_ROW(n);
+    
+    for (int j = 0; j <= n; j++) {
+	put_index(m, indices, idx++, k * n + j % n);
+	put_index(m, indices, idx++, next + j % n);
+    }
+}
+
+static void torus_rows(const struct torus_job *job)
+{
+    const struct mesh *m = job->m;
+    const struct vertex_format *f = m->format;
+    int n = job->n;
+    char *vertices = (char *) m->vertices + job->chunk->vertex_offset;
+    char *indices = (char *) m->indices + job->chunk->index_offset;
+    
+    for (int k = job->k0; k < job->k1; k++) {
+	int i = (job->first_row + k) % n;
+	float c = cos(2 * M_PI * i / n);
+	float s = sin(2 * M_PI * i / n);
+	
+	/* Y 軸回りに c, s だけ回した、X 方向に RADIUS ずらした円 */
+	for (int j = 0; j < n; j++) {
+	    float c0 = cos(2 * M_PI * j / n);
+	    float s0 = sin(2 * M_PI * j / n);
+	    float x = RADIUS + MINOR_RADIUS * c0;
+	    struct vertex_t v = {
+		.position = { c * x, MINOR_RADIUS * s0, -s * x },
+		.normal = { c * c0, s0, -s * c0 },
+		.texture = { (float) i / n, (float) j / n },
+		.color = { (float) i / n, (float) j / n, 0 },
+	    };
+	    void *dst = vertices + ((size_t) k * n + j) * f->stride;
+	    if (f == &packed_format)
+		pack_vertex(dst, &v, f->position_scale);
+	    else
+		*(struct vertex_t *) dst = v;
+	}
+	
+	if (k >= job->nr_quad_rows)
+	    continue;
+	if (m->mode == GL_TRIANGLE_STRIP) {
+	    torus_strip_row(job, indices, k);
+	    continue;
+	}
+	size_t idx = (size_t) k * n * 6;
+	for (int j = 0; j < n; j++) {
+	    uint32_t i0 = k * n + j;
+	    uint32_t i1 = k * n + (j + 1) % n;
+	    uint32_t i2 = (k + 1) % job->nr_rows * n + j;
+	    uint32_t i3 = (k + 1) % job->nr_rows * n + (j + 1) % n;
+	    uint32_t quad[6] = { i0, i2, i1, i2, i3, i1 };
+	    
+	    for (int q = 0; q < 6; q++)
+		put_index(m, indices, idx++, quad[q]);
+	}
+    }
+}
+
+static void *torus_thread(void *data)
+{
+    struct torus_work *work = data;
+    int i;
+    
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->nr_jobs)
+	torus_rows(&work->jobs[i]);
+    return NULL;
+}
+
+void create_torus(struct mesh *m, struct arena *a, int n, const struct vertex_format *format,
+	int index_size, int strip, int nr_threads)
+{
+    /* 16 bit の chunk は quad 1 行分と次の 1 行は持てないといけない */
+    int quad_rows = n;
+    if (index_size == 2 && (size_t) n * n > 65536) {
+	quad_rows = 65536 / n - 1;
+	if (quad_rows < 1) {
+	    fprintf(stderr, "torus: %d is too large for 16-bit indices.\n", n);
+	    exit(1);
+	}
+    }
+    
+    m->format = format;
+    m->mode = strip ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+    m->index_size = index_size;
+    m->nr_chunks = (n + quad_rows - 1) / quad_rows;
+    m->chunks = arena_alloc(a, m->nr_chunks * sizeof *m->chunks);
+    m->nr_vertices = m->nr_indices = 0;
+    
+    for (int c = 0; c < m->nr_chunks; c++) {
+	struct mesh_chunk *chunk = &m->chunks[c];
+	int rows = c == m->nr_chunks - 1 ? n - c * quad_rows : quad_rows;
+	int vertex_rows = m->nr_chunks == 1 ? n : rows + 1;
+	
+	chunk->vertex_offset = (size_t) m->nr_vertices * format->stride;
+	chunk->index_offset = (size_t) m->nr_indices * index_size;
+	chunk->nr_vertices = vertex_rows * n;
+	chunk->nr_indices = strip ? rows * STRIP_ROW(n) : rows * n * 6;
+	m->nr_vertices += chunk->nr_vertices;
+	m->nr_indices += chunk->nr_indices;
+    }
+    
+    m->vertices_size = (size_t) m->nr_vertices * format->stride;
+    m->indices_size = (size_t) m->nr_indices * index_size;
+    m->vertices = arena_alloc(a, m->vertices_size);
+    m->indices = arena_alloc(a, m->indices_size);
+    
+    /* thread が偏らないように 1 thread あたり 4 job くらいに切る */
+    int rows_per_job = n / (nr_threads * 4);
+    if (rows_per_job < 8)
+	rows_per_job = 8;
+    struct torus_work work = { NULL, 0, 0 };
+    for (int c = 0; c < m->nr_chunks; c++)
+	work.nr_jobs += (m->chunks[c].nr_vertices / n + rows_per_job - 1) / rows_per_job;
+    work.jobs = arena_alloc(a, work.nr_jobs * sizeof *work.jobs);
+    
+    struct torus_job *job = work.jobs;
+    for (int c = 0; c < m->nr_chunks; c++) {
+	int nr_rows = m->chunks[c].nr_vertices / n;
+	for (int k = 0; k < nr_rows; k += rows_per_job) {
+	    *job++ = (struct torus_job) {
+		.m = m,
+		.chunk = &m->chunks[c],
+		.n = n,
+		.first_row = c * quad_rows,
+		.nr_rows = nr_rows,
+		.nr_quad_rows = c == m->nr_chunks - 1 ? n - c * quad_rows : quad_rows,
+		.k0 = k,
+		.k1 = k + rows_per_job < nr_rows ? k + rows_per_job : nr_rows,
+	    };
+	}
+    }
+    
+    pthread_t threads[nr_threads];
+    int started = 0;
+    for (int i = 1; i < nr_threads && i < work.nr_jobs; i++, started++) {
+	if (pthread_create(&threads[started], NULL, torus_thread, &work) != 0)
+	    break;
+    }
+    torus_thread(&work);
+    for (int i = 0; i < started; i++)
+	pthread_join(threads[i], NULL);
+}
+
+void create_flat(struct mesh *m, struct arena *a)
+{
+    static const struct vertex_t vertices[16] = {
+	{ {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } },
+	{ { 100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } },
+	{ {   0, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } },
+	{ { 100, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 1 } },
+	{ {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+	{ {   0, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+	{ {-100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+	{ {-100, 100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+	{ {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } },
+	{ {-100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } },
+	{ {   0,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } },
+	{ {-100,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 1, 1 } },
+	{ {   0,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+	{ {   0,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+	{ { 100,   0, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+	{ { 100,-100, 0 }, { 0, 0, -1 }, { 0, 0 }, { 0, 0, 0 } },
+    };
+    static const uint16_t indices[24] = {
+	 0,  1,  2,   2,  1,  3,
+	 4,  5,  6,   6,  5,  7,
+	 8,  9, 10,  10,  9, 11,
+	12, 13, 14,  14, 13, 15,
+    };
+    
+    m->format = &float_format;
+    m->mode = GL_TRIANGLES;
+    m->index_size = 2;
+    m->nr_vertices = 16;
+    m->nr_indices = 24;
+    m->vertices_size = sizeof vertices;
+    m->indices_size = sizeof indices;
+    m->vertices = arena_alloc(a, sizeof vertices);
+    m->indices = arena_alloc(a, sizeof indices);
+    memcpy(m->vertices, vertices, sizeof vertices);
+    memcpy(m->indices, indices, sizeof indices);
+    m->nr_chunks = 1;
+    m->chunks = arena_alloc(a, sizeof *m->chunks);
+    m->chunks[0] = (struct mesh_chunk) { 0, 0, 16, 24 };
+}
+
+void mesh_measure(const struct mesh *m, struct vcache_stats *st, struct arena *a)
+{
+    for (int c = 0; c < m->nr_chunks; c++) {
+	const struct mesh_chunk *chunk = &m->chunks[c];
+	vcache_measure(st, (char *) m->indices + chunk->index_offset, m->index_size,
+		chunk->nr_indices, chunk->nr_vertices, m->mode == GL_TRIANGLE_STRIP, a);
+    }
+}
+
+void mesh_optimize(struct mesh *m, struct arena *a)
+{
+    if (m->mode != GL_TRIANGLES)
+	return;
+    for (int c = 0; c < m->nr_chunks; c++) {
+	const struct mesh_chunk *chunk = &m->chunks[c];
+	vcache_optimize((char *) m->indices + chunk->index_offset, m->index_size,
+		chunk->nr_indices, chunk->nr_vertices, a);
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include <GLES2/gl2.h>
+#include "arena.h"
+#include "vcache.h"
+
+struct vertex_t {
+    struct {
+	float x, y, z;
+    } position;
+    struct {
+	float nx, ny, nz;
+    } normal;
+    struct {
+	float u, v;
+    } texture;
+    struct {
+	float r, g, b;
+    } color;
+};
+
+/*
+ * GPU に渡す方は 24 byte。position は snorm16 で、
+ * 描くときに position_scale 倍に戻す。normal も snorm16、uv は unorm16、
+ * color は unorm8。どの attrib も 4 byte 境界から始まるように、
+ * position と normal と color の 4 つ目は詰め物にしている。
+ */
+struct packed_vertex_t {
+    int16_t position[4];
+    int16_t normal[4];
+    uint16_t texture[2];
+    uint8_t color[4];
+};
+
+struct attrib_format {
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    int offset;
+};
+
+struct vertex_format {
+    int stride;
+    float position_scale;
+    struct attrib_format position, normal, texture, color;
+};
+
+extern const struct vertex_format float_format, packed_format;
+
+#define TORUS_N 100
+#define RADIUS (3.0f)
+#define MINOR_RADIUS (1.0f)
+
+/*
+ * GLES2 には base vertex が無いので、16 bit index で 65536 頂点を
+ * 越えるときは chunk ごとに頂点を持たせて、chunk ごとに attrib の
+ * 位置をずらして描く。offset は byte。
+ */
+struct mesh_chunk {
+    size_t vertex_offset, index_offset;
+    int nr_vertices, nr_indices;
+};
+
+struct mesh {
+    const struct vertex_format *format;
+    GLenum mode;		/* GL_TRIANGLES か GL_TRIANGLE_STRIP */
+    int index_size;		/* 2 か 4 */
+    void *vertices, *indices;
+    size_t vertices_size, indices_size;
+    int nr_vertices, nr_indices;
+    struct mesh_chunk *chunks;
+    int nr_chunks;
+};
+
+/*
+ * 全部 arena から取る。index_size が 2 で n * n が 65536 を越えると chunk に分ける。
+ * strip なら 1 行ずつの strip をつないで、chunk ごとに restart 無しの 1 本にする。
+ */
+void create_torus(struct mesh *m, struct arena *a, int n, const struct vertex_format *format,
+	int index_size, int strip, int nr_threads);
+void create_flat(struct mesh *m, struct arena *a);
+
+void mesh_measure(const struct mesh *m, struct vcache_stats *st, struct arena *a);
+/* 三角形の順番だけ変える。strip はそのまま。 */
+void mesh_optimize(struct mesh *m, struct arena *a);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * program binary の cache。file は header の後に driver から
+ * もらった binary をそのまま置いたもの。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include "glstate.h"
+#include "cache.h"
+#include "progcache.h"
+
+#define PROGCACHE_MAGIC "GTKPROG\0"
+
+struct progcache_header {
+    char magic[8];
+    uint64_t key;
+    uint32_t format, length;
+};
+
+static PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+static PFNGLPROGRAMBINARYOESPROC program_binary;
+static uint64_t driver_key;
+
+void program_cache_init(void)
+{
+    if (!gl_has_extension("GL_OES_get_program_binary")) {
+	fprintf(stderr, "no GL_OES_get_program_binary, compiling shaders every time.\n");
+	return;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+    if (formats <= 0) {
+	fprintf(stderr, "no program binary formats, compiling shaders every time.\n");
+	return;
+    }
+    
+    get_program_binary = (void *) eglGetProcAddress("glGetProgramBinaryOES");
+    program_binary = (void *) eglGetProcAddress("glProgramBinaryOES");
+    if (get_program_binary == NULL || program_binary == NULL) {
+	get_program_binary = NULL;
+	program_binary = NULL;
+	return;
+    }
+    
+    static const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    driver_key = CACHE_HASH_INIT;
+    for (int i = 0; i < 3; i++) {
+	const char *s = (const char *) glGetString(names[i]);
+	if (s != NULL)
+	    driver_key = cache_hash(s, strlen(s) + 1, driver_key);
+    }
+}
+
+static void cache_name(char *name, size_t size, uint64_t *key, const char *vs_src, const char *fs_src)
+{
+    *key = cache_hash(vs_src, strlen(vs_src) + 1, driver_key);
+    *key = cache_hash(fs_src, strlen(fs_src) + 1, *key);
+    snprintf(name, size, "%016llx.prog", (unsigned long long) *key);
+}
+
+GLuint program_cache_load(const char *vs_src, const char *fs_src)
+{
+    char name[32];
+    uint64_t key;
+    size_t size;
+    
+    if (program_binary == NULL)
+	return 0;
+    cache_name(name, sizeof name, &key, vs_src, fs_src);
+    const struct progcache_header *h = cache_map(name, &size);
+    if (h == NULL)
+	return 0;
+    
+    GLuint prog = 0;
+    if (size >= sizeof *h && memcmp(h->magic, PROGCACHE_MAGIC, sizeof h->magic) == 0 &&
+	    h->key == key && h->length == size - sizeof *h) {
+	prog = glCreateProgram();
+	program_binary(prog, h->format, h + 1, h->length);
+	
+	/* driver の更新などで受け付けられなければ作り直して上書きする */
+	GLint status = GL_FALSE;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+	    fprintf(stderr, "%s: program binary rejected, compiling from source.\n", name);
+	    glDeleteProgram(prog);
+	    prog = 0;
+	}
+    }
+    cache_unmap((void *) h, size);
+    return prog;
+}
+
+void program_cache_store(GLuint prog, const char *vs_src, const char *fs_src)
+{
+    char name[32];
+    uint64_t key;
+    
+    if (get_program_binary == NULL)
+	return;
+    
+    GLint length = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0)
+	return;
+    struct progcache_header *h = malloc(sizeof *h + length);
+    if (h == NULL)
+	return;
+    GLenum format;
+    GLsizei written = 0;
+    get_program_binary(prog, length, &written, &format, h + 1);
+    if (written > 0) {
+	cache_name(name, sizeof name, &key, vs_src, fs_src);
+	memcpy(h->magic, PROGCACHE_MAGIC, sizeof h->magic);
+	h->key = key;
+	h->format = format;
+	h->length = written;
+	cache_write(name, h, sizeof *h + written);
+    }
+    free(h);
+}
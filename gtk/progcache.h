@@ -0,0 +1,18 @@
+#ifndef PROGCACHE_H
+#define PROGCACHE_H
+
+#include <GLES2/gl2.h>
+
+/*
+ * GL_OES_get_program_binary で link 済みの program を cache に置く。
+ * key は shader の source と GL_VENDOR/RENDERER/VERSION なので、
+ * driver が変われば別の file になる。
+ */
+
+/* context が current になってから呼ぶ */
+void program_cache_init(void);
+/* 無いか driver に断られたら 0。そのときは source から作って store する。 */
+GLuint program_cache_load(const char *vs_src, const char *fs_src);
+void program_cache_store(GLuint prog, const char *vs_src, const char *fs_src);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * テクスチャの前処理と、その結果の cache。cache の file は header と
+ * level ごとの画素をそのまま並べたもので、mmap して level を指すだけで
+ * glTexImage2D や glCompressedTexImage2D に渡せる。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "image.h"
+#include "etc1.h"
+#include "cache.h"
+#include "texcache.h"
+
+#define TEXCACHE_MAGIC "GTKTEX\0\0"
+#define TEXCACHE_VERSION 1
+#define TEXCACHE_ALIGN 64
+
+struct texcache_header {
+    char magic[8];
+    uint64_t key;
+    uint32_t format, bpp, nr_levels, pad;
+    struct {
+	uint32_t width, height, offset, size;
+    } levels[TEXTURE_MAX_LEVELS];
+};
+
+/* 近い方の 2 のべき乗。mipmap は GLES2 では 2 のべき乗でないと使えない。 */
+static int pot(int n)
+{
+    int p = 1;
+    while (p * 2 <= n)
+	p *= 2;
+    return n - p > p * 2 - n ? p * 2 : p;
+}
+
+/*
+ * 1 列を三角 filter で src_len から dst_len に伸縮する。縮めるときは
+ * filter の幅を縮める率に合わせて広げる。
+ */
+static void resample(float *dst, int dst_len, size_t dst_step,
+		     const float *src, int src_len, size_t src_step, int channels)
+{
+    float scale = (float) src_len / dst_len;
+    float r = scale > 1 ? scale : 1;
+    
+    for (int i = 0; i < dst_len; i++) {
+	float center = (i + 0.5f) * scale - 0.5f;
+	float sum[4] = { 0, }, total = 0;
+	for (int j = ceilf(center - r); j <= floorf(center + r); j++) {
+	    float w = 1 - fabsf(j - center) / r;
+	    if (w <= 0)
+		continue;
+	    int k = j < 0 ? 0 : j >= src_len ? src_len - 1 : j;
+	    for (int c = 0; c < channels; c++)
+		sum[c] += w * src[k * src_step + c];
+	    total += w;
+	}
+	for (int c = 0; c < channels; c++)
+	    dst[i * dst_step + c] = sum[c] / total;
+    }
+}
+
+/* 横、縦の順に伸縮して level 0 を作る。channels が bpp より少なければ後ろを捨てる。 */
+static void scale_image(unsigned char *dst, int width, int height, const struct image *img, int channels)
+{
+    size_t n = (size_t) img->width * img->height;
+    float *src = malloc(n * channels * sizeof *src);
+    float *wide = malloc((size_t) width * img->height * channels * sizeof *wide);
+    float *out = malloc((size_t) width * height * channels * sizeof *out);
+    if (src == NULL || wide == NULL || out == NULL) {
+	fprintf(stderr, "out of memory.\n");
+	exit(1);
+    }
+    
+    for (size_t i = 0; i < n; i++)
+	for (int c = 0; c < channels; c++)
+	    src[i * channels + c] = img->pixels[i * img->bpp + c];
+    for (int y = 0; y < img->height; y++)
+	resample(wide + (size_t) y * width * channels, width, channels,
+		src + (size_t) y * img->width * channels, img->width, channels, channels);
+    for (int x = 0; x < width; x++)
+	resample(out + x * channels, height, (size_t) width * channels,
+		wide + x * channels, img->height, (size_t) width * channels, channels);
+    for (size_t i = 0; i < (size_t) width * height * channels; i++)
+	dst[i] = out[i] < 0 ? 0 : out[i] > 255 ? 255 : (int) (out[i] + 0.5f);
+    
+    free(src);
+    free(wide);
+    free(out);
+}
+
+/* 2x2 の平均で半分に。片方が 1 になったらもう片方だけ縮める。 */
+static void halve(unsigned char *dst, int width, int height, const unsigned char *src, int src_width, int src_height, int channels)
+{
+    for (int y = 0; y < height; y++) {
+	int y0 = y * 2, y1 = src_height > 1 ? y * 2 + 1 : y * 2;
+	for (int x = 0; x < width; x++) {
+	    int x0 = x * 2, x1 = src_width > 1 ? x * 2 + 1 : x * 2;
+	    for (int c = 0; c < channels; c++) {
+		int sum = src[((size_t) y0 * src_width + x0) * channels + c] +
+			src[((size_t) y0 * src_width + x1) * channels + c] +
+			src[((size_t) y1 * src_width + x0) * channels + c] +
+			src[((size_t) y1 * src_width + x1) * channels + c];
+		dst[((size_t) y * width + x) * channels + c] = (sum + 2) / 4;
+	    }
+	}
+    }
+}
+
+/* header を確かめて level を埋める。data は tex->data になる。 */
+static int parse(struct texture *tex, void *data, size_t size, uint64_t key)
+{
+    const struct texcache_header *h = data;
+    
+    if (size < sizeof *h || memcmp(h->magic, TEXCACHE_MAGIC, sizeof h->magic) != 0 ||
+	    h->key != key || h->nr_levels < 1 || h->nr_levels > TEXTURE_MAX_LEVELS)
+	return -1;
+    for (unsigned int l = 0; l < h->nr_levels; l++) {
+	if (h->levels[l].offset > size || h->levels[l].size > size - h->levels[l].offset)
+	    return -1;
+	tex->levels[l].width = h->levels[l].width;
+	tex->levels[l].height = h->levels[l].height;
+	tex->levels[l].data = (const unsigned char *) data + h->levels[l].offset;
+	tex->levels[l].size = h->levels[l].size;
+    }
+    tex->format = h->format;
+    tex->bpp = h->bpp;
+    tex->nr_levels = h->nr_levels;
+    tex->data = data;
+    tex->size = size;
+    return 0;
+}
+
+static void build(struct texture *tex, const struct image *img, uint64_t key, int flags)
+{
+    int etc1 = flags & TEXTURE_ETC1;
+    int channels = etc1 ? 3 : img->bpp;
+    struct texcache_header h;
+    size_t offset = (sizeof h + TEXCACHE_ALIGN - 1) & ~(size_t) (TEXCACHE_ALIGN - 1);
+    size_t raw_offsets[TEXTURE_MAX_LEVELS], raw_size = 0;
+    
+    /* ETC1 でなければ画素は file の中に直接作る */
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, TEXCACHE_MAGIC, sizeof h.magic);
+    h.key = key;
+    h.format = etc1 ? GL_ETC1_RGB8_OES : img->format;
+    h.bpp = etc1 ? 0 : channels;
+    int width = pot(img->width), height = pot(img->height);
+    for (;;) {
+	int l = h.nr_levels++;
+	size_t raw = (size_t) width * height * channels;
+	h.levels[l].width = width;
+	h.levels[l].height = height;
+	h.levels[l].offset = offset;
+	h.levels[l].size = etc1 ? etc1_size(width, height) : raw;
+	offset = (offset + h.levels[l].size + TEXCACHE_ALIGN - 1) & ~(size_t) (TEXCACHE_ALIGN - 1);
+	raw_offsets[l] = raw_size;
+	raw_size += raw;
+	if ((width == 1 && height == 1) || h.nr_levels == TEXTURE_MAX_LEVELS)
+	    break;
+	width = width > 1 ? width / 2 : 1;
+	height = height > 1 ? height / 2 : 1;
+    }
+    
+    unsigned char *file = calloc(1, offset);
+    unsigned char *scratch = etc1 ? malloc(raw_size) : NULL;
+    if (file == NULL || (etc1 && scratch == NULL)) {
+	fprintf(stderr, "out of memory.\n");
+	exit(1);
+    }
+    memcpy(file, &h, sizeof h);
+    
+    unsigned char *prev = NULL;
+    for (unsigned int l = 0; l < h.nr_levels; l++) {
+	unsigned char *px = etc1 ? scratch + raw_offsets[l] : file + h.levels[l].offset;
+	if (l == 0)
+	    scale_image(px, h.levels[0].width, h.levels[0].height, img, channels);
+	else
+	    halve(px, h.levels[l].width, h.levels[l].height,
+		    prev, h.levels[l - 1].width, h.levels[l - 1].height, channels);
+	if (etc1)
+	    etc1_encode(file + h.levels[l].offset, px, h.levels[l].width, h.levels[l].height, channels);
+	prev = px;
+    }
+    free(scratch);
+    parse(tex, file, offset, key);
+}
+
+int texture_load(struct texture *tex, const char *path, int flags)
+{
+    uint64_t key = CACHE_HASH_INIT;
+    int version = TEXCACHE_VERSION;
+    char name[32];
+    size_t size;
+    
+    memset(tex, 0, sizeof *tex);
+    key = cache_hash(&version, sizeof version, key);
+    key = cache_hash(&flags, sizeof flags, key);
+    if (cache_hash_file(path, &key) < 0)
+	return -1;
+    snprintf(name, sizeof name, "%016llx.tex", (unsigned long long) key);
+    
+    void *data = cache_map(name, &size);
+    if (data != NULL) {
+	if (parse(tex, data, size, key) == 0) {
+	    tex->cached = 1;
+	    return 0;
+	}
+	/* 古いか壊れているので作り直して上書きする */
+	cache_unmap(data, size);
+	memset(tex, 0, sizeof *tex);
+    }
+    
+    struct image img;
+    if (image_load(&img, path) < 0)
+	return -1;
+    build(tex, &img, key, flags);
+    image_free(&img);
+    cache_write(name, tex->data, tex->size);
+    return 0;
+}
+
+void texture_free(struct texture *tex)
+{
+    if (tex->cached)
+	cache_unmap(tex->data, tex->size);
+    else
+	free(tex->data);
+    memset(tex, 0, sizeof *tex);
+}
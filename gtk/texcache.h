@@ -0,0 +1,38 @@
+#ifndef TEXCACHE_H
+#define TEXCACHE_H
+
+#include <stddef.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+/*
+ * mipmap まで作ったテクスチャ。一辺を近い方の 2 のべき乗に伸縮して
+ * 1x1 まで縮めた列を持つ。作ったものは元 file の hash を名前にして
+ * cache に書き、次からはそれを mmap してそのまま upload する。
+ */
+#define TEXTURE_MAX_LEVELS 16
+#define TEXTURE_ETC1 1
+
+struct texture_level {
+    int width, height;
+    const unsigned char *data;
+    size_t size;
+};
+
+struct texture {
+    GLenum format;		/* GL_RGB, GL_RGBA か GL_ETC1_RGB8_OES */
+    int bpp;			/* ETC1 なら 0 */
+    int nr_levels;
+    struct texture_level levels[TEXTURE_MAX_LEVELS];
+    int cached;
+
+    /* cache から読んだなら mmap したもの、作ったなら malloc したもの */
+    void *data;
+    size_t size;
+};
+
+/* flags は TEXTURE_ETC1。失敗したら -1 でメッセージを出す。 */
+int texture_load(struct texture *tex, const char *path, int flags);
+void texture_free(struct texture *tex);
+
+#endif
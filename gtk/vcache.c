@@ -0,0 +1,204 @@
+/*
+ * 頂点キャッシュのシミュレーションと、Forsyth の linear-speed
+ * vertex cache optimisation。
+ */
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "vcache.h"
+
+static uint32_t get_index(const void *indices, int index_size, int i)
+{
+    return index_size == 4 ? ((const uint32_t *) indices)[i] : ((const uint16_t *) indices)[i];
+}
+
+static void set_index(void *indices, int index_size, int i, uint32_t v)
+{
+    if (index_size == 4)
+	((uint32_t *) indices)[i] = v;
+    else
+	((uint16_t *) indices)[i] = v;
+}
+
+/* FIFO。hardware に近いのはこちら。 */
+void vcache_measure(struct vcache_stats *st, const void *indices, int index_size,
+	int nr_indices, int nr_vertices, int strip, struct arena *a)
+{
+    /* 頂点ごとに最後に入った時刻。時刻が VCACHE_SIZE 以上前なら追い出されている */
+    long *stamp = arena_alloc(a, nr_vertices * sizeof *stamp);
+    long clock = VCACHE_SIZE;
+    for (int i = 0; i < nr_vertices; i++)
+	stamp[i] = -1;
+    
+    long transforms = 0, used = 0;
+    for (int i = 0; i < nr_indices; i++) {
+	uint32_t v = get_index(indices, index_size, i);
+	if (stamp[v] < 0)
+	    used++;
+	if (stamp[v] < 0 || clock - stamp[v] >= VCACHE_SIZE) {
+	    stamp[v] = ++clock;
+	    transforms++;
+	}
+    }
+    
+    long triangles = 0;
+    if (strip) {
+	for (int i = 2; i < nr_indices; i++) {
+	    uint32_t i0 = get_index(indices, index_size, i - 2);
+	    uint32_t i1 = get_index(indices, index_size, i - 1);
+	    uint32_t i2 = get_index(indices, index_size, i);
+	    if (i0 != i1 && i1 != i2 && i0 != i2)
+		triangles++;
+	}
+    } else {
+	triangles = nr_indices / 3;
+    }
+    
+    st->triangles += triangles;
+    st->vertices += used;
+    st->transforms += transforms;
+}
+
+/* Forsyth の score。定数は原文のまま。 */
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRI_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+#define MAX_VALENCE 64
+
+struct vc_vertex {
+    int cache_pos;
+    int remaining;
+    int first, count;		/* adjacency の中の自分の三角形 */
+    float score;
+};
+
+static float cache_score[VCACHE_SIZE];
+static float valence_score[MAX_VALENCE];
+
+static void init_scores(void)
+{
+    if (valence_score[1] != 0)
+	return;
+    for (int i = 0; i < VCACHE_SIZE; i++) {
+	if (i < 3) {
+	    cache_score[i] = LAST_TRI_SCORE;
+	} else {
+	    float s = 1.0f - (float) (i - 3) / (VCACHE_SIZE - 3);
+	    cache_score[i] = powf(s, CACHE_DECAY_POWER);
+	}
+    }
+    for (int i = 1; i < MAX_VALENCE; i++)
+	valence_score[i] = VALENCE_BOOST_SCALE * powf(i, -VALENCE_BOOST_POWER);
+}
+
+static float vertex_score(const struct vc_vertex *v)
+{
+    if (v->remaining == 0)
+	return -1.0f;
+    float score = v->cache_pos >= 0 ? cache_score[v->cache_pos] : 0;
+    return score + valence_score[v->remaining < MAX_VALENCE ? v->remaining : MAX_VALENCE - 1];
+}
+
+void vcache_optimize(void *indices, int index_size, int nr_indices, int nr_vertices, struct arena *a)
+{
+    int nr_tris = nr_indices / 3;
+    if (nr_tris == 0)
+	return;
+    init_scores();
+    
+    struct vc_vertex *verts = arena_alloc(a, nr_vertices * sizeof *verts);
+    int *adjacency = arena_alloc(a, nr_indices * sizeof *adjacency);
+    uint32_t *tri_index = arena_alloc(a, nr_indices * sizeof *tri_index);
+    float *tri_score = arena_alloc(a, nr_tris * sizeof *tri_score);
+    char *added = arena_alloc(a, nr_tris);
+    
+    memset(verts, 0, nr_vertices * sizeof *verts);
+    memset(added, 0, nr_tris);
+    for (int i = 0; i < nr_indices; i++) {
+	tri_index[i] = get_index(indices, index_size, i);
+	verts[tri_index[i]].remaining++;
+    }
+    int first = 0;
+    for (int v = 0; v < nr_vertices; v++) {
+	verts[v].first = first;
+	first += verts[v].remaining;
+	verts[v].count = 0;
+	verts[v].cache_pos = -1;
+    }
+    for (int i = 0; i < nr_indices; i++) {
+	struct vc_vertex *v = &verts[tri_index[i]];
+	adjacency[v->first + v->count++] = i / 3;
+    }
+    for (int v = 0; v < nr_vertices; v++)
+	verts[v].score = vertex_score(&verts[v]);
+    for (int t = 0; t < nr_tris; t++) {
+	tri_score[t] = verts[tri_index[t * 3]].score + verts[tri_index[t * 3 + 1]].score +
+	    verts[tri_index[t * 3 + 2]].score;
+    }
+    
+    /* LRU。三角形を足す間だけ 3 つはみ出す */
+    uint32_t cache[VCACHE_SIZE + 3];
+    int cache_used = 0;
+    int best = 0, scan = 0;
+    
+    for (int out = 0; out < nr_tris; out++) {
+	if (best < 0) {
+	    /* cache の周りに候補が無いときは順番に次の三角形 */
+	    while (added[scan])
+		scan++;
+	    best = scan;
+	}
+	
+	added[best] = 1;
+	for (int k = 0; k < 3; k++)
+	    set_index(indices, index_size, out * 3 + k, tri_index[best * 3 + k]);
+	
+	/* 三角形を adjacency から外して、3 頂点を cache の先頭に */
+	uint32_t new_cache[VCACHE_SIZE + 3];
+	int new_used = 0;
+	for (int k = 0; k < 3; k++) {
+	    uint32_t vi = tri_index[best * 3 + k];
+	    struct vc_vertex *v = &verts[vi];
+	    int *adj = &adjacency[v->first];
+	    for (int j = 0; j < v->remaining; j++) {
+		if (adj[j] == best) {
+		    adj[j] = adj[v->remaining - 1];
+		    break;
+		}
+	    }
+	    v->remaining--;
+	    new_cache[new_used++] = vi;
+	}
+	for (int j = 0; j < cache_used; j++) {
+	    uint32_t vi = cache[j];
+	    if (vi != new_cache[0] && vi != new_cache[1] && vi != new_cache[2])
+		new_cache[new_used++] = vi;
+	}
+	
+	/* 追い出された頂点も含めて score を更新してから、次の候補を探す */
+	for (int j = 0; j < new_used; j++) {
+	    struct vc_vertex *v = &verts[new_cache[j]];
+	    v->cache_pos = j < VCACHE_SIZE ? j : -1;
+	    float score = vertex_score(v);
+	    float delta = score - v->score;
+	    v->score = score;
+	    for (int t = 0; t < v->remaining; t++)
+		tri_score[adjacency[v->first + t]] += delta;
+	}
+	float best_score = -1;
+	best = -1;
+	for (int j = 0; j < new_used && j < VCACHE_SIZE; j++) {
+	    struct vc_vertex *v = &verts[new_cache[j]];
+	    for (int t = 0; t < v->remaining; t++) {
+		int tri = adjacency[v->first + t];
+		if (tri_score[tri] > best_score) {
+		    best_score = tri_score[tri];
+		    best = tri;
+		}
+	    }
+	}
+	cache_used = new_used < VCACHE_SIZE ? new_used : VCACHE_SIZE;
+	memcpy(cache, new_cache, cache_used * sizeof *cache);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef VCACHE_H
+#define VCACHE_H
+
+#include "arena.h"
+
+/* post-transform cache の大きさ。測るのも並べ替えるのもこれで見る。 */
+#define VCACHE_SIZE 32
+
+/* 何回 vertex shader が走るか。chunk ごとに足していける。 */
+struct vcache_stats {
+    long triangles, vertices, transforms;
+};
+
+/* strip なら GL_TRIANGLE_STRIP として数える。縮退三角形は数えない。 */
+void vcache_measure(struct vcache_stats *st, const void *indices, int index_size,
+	int nr_indices, int nr_vertices, int strip, struct arena *a);
+/*
+ * 三角形の順番を Forsyth の方法で並べ替える。三角形の中の頂点の順番
+ * (表裏) はそのまま。
+ */
+void vcache_optimize(void *indices, int index_size, int nr_indices, int nr_vertices, struct arena *a);
+
+static inline double vcache_acmr(const struct vcache_stats *st)
+{
+    return st->triangles ? (double) st->transforms / st->triangles : 0;
+}
+
+static inline double vcache_atvr(const struct vcache_stats *st)
+{
+    return st->vertices ? (double) st->transforms / st->vertices : 0;
+}
+
+#endif